@@ -39,6 +39,7 @@
 #include <cstdio>
 #include <cstdarg>
 
+#include <atomic>
 #include <iostream>
 #include <mutex>
 
@@ -58,7 +59,7 @@ struct DefaultOutputHandler
 	OutputHandlerSTD std_output_handler_;
 	OutputHandler   *output_handler_;
 	OutputHandler   *previous_output_handler_;
-	LogLevel         logLevel_;
+	std::atomic<LogLevel> logLevel_; // read without lock_ so filtered messages cost no lock
 	std::mutex       lock_; // it is likely the outputhandler does some I/O, so we serialize it
 };
 
@@ -107,8 +108,11 @@ OutputHandler* getOutputHandler(void)
 
 void log(const char *file, int line, LogLevel level, const char* m, ...)
 {
+	if (level < getDOH()->logLevel_.load(std::memory_order_relaxed)) {
+		return;
+	}
 	USE_DOH;
-	if (doh->output_handler_ && level >= doh->logLevel_)
+	if (doh->output_handler_)
 	{
 		va_list __ap;
 		va_start(__ap, m);
@@ -127,14 +131,12 @@ void log(const char *file, int line, LogLevel level, const char* m, ...)
 
 void setLogLevel(LogLevel level)
 {
-	USE_DOH;
-	doh->logLevel_ = level;
+	getDOH()->logLevel_.store(level, std::memory_order_relaxed);
 }
 
 LogLevel getLogLevel(void)
 {
-	USE_DOH;
-	return doh->logLevel_;
+	return getDOH()->logLevel_.load(std::memory_order_relaxed);
 }
 
 static const char* LogLevelString[4] = { "Debug:   ", "Info:    ", "Warning: ", "Error:   " };
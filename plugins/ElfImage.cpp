@@ -0,0 +1,228 @@
+#include "ElfImage.hpp"
+
+#include <cstring>
+
+#if defined(__linux__)
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace plugin
+{
+namespace impl
+{
+
+#if defined(__linux__)
+
+namespace
+{
+
+unsigned char getHostByteOrder()
+{
+	const std::uint16_t probe = 1;
+	unsigned char first_byte;
+	std::memcpy(&first_byte, &probe, 1);
+	return 1 == first_byte ? ELFDATA2LSB : ELFDATA2MSB;
+}
+
+// Copies a structure out of the file, since nothing guarantees its alignment there
+template<class T>
+bool readAt(const unsigned char * data, std::size_t size, std::uint64_t offset, T & value)
+{
+	if (offset > size || sizeof(T) > size - offset) {
+		return false;
+	}
+	std::memcpy(&value, data + offset, sizeof(T));
+	return true;
+}
+
+} // namespace
+
+ElfImage::ElfImage(const std::string & path)
+	: path_(path), data_(nullptr), size_(0), is_64_bit_(false), section_names_index_(0)
+{
+	const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+	struct stat status;
+	if (0 == ::fstat(fd, &status) && status.st_size > 0) {
+		void * data = ::mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (MAP_FAILED != data) {
+			data_ = static_cast<const unsigned char *>(data);
+			size_ = static_cast<std::size_t>(status.st_size);
+		}
+	}
+	::close(fd);
+
+	if (size_ < EI_NIDENT || std::memcmp(data_, ELFMAG, SELFMAG) != 0 || data_[EI_DATA] != getHostByteOrder()) {
+		return;
+	}
+	if (ELFCLASS64 == data_[EI_CLASS]) {
+		is_64_bit_ = true;
+		readSections<Elf64_Ehdr, Elf64_Shdr>();
+	} else if (ELFCLASS32 == data_[EI_CLASS]) {
+		readSections<Elf32_Ehdr, Elf32_Shdr>();
+	}
+}
+
+ElfImage::~ElfImage()
+{
+	if (data_) {
+		::munmap(const_cast<unsigned char *>(data_), size_);
+	}
+}
+
+template<class FileHeader, class SectionHeader>
+void ElfImage::readSections()
+{
+	FileHeader header;
+	if (!readAt(data_, size_, 0, header) || 0 == header.e_shoff ||
+		header.e_shentsize != sizeof(SectionHeader) || header.e_shstrndx >= header.e_shnum ||
+		header.e_shoff > size_ || (size_ - header.e_shoff) / sizeof(SectionHeader) < header.e_shnum)
+	{
+		return;
+	}
+	sections_.reserve(header.e_shnum);
+	for (std::size_t i = 0; i < header.e_shnum; ++i) {
+		SectionHeader section_header;
+		readAt(data_, size_, header.e_shoff + i * sizeof(SectionHeader), section_header);
+		sections_.push_back(Section{section_header.sh_name, section_header.sh_type, section_header.sh_link,
+			section_header.sh_offset, section_header.sh_size});
+	}
+	section_names_index_ = header.e_shstrndx;
+}
+
+std::string_view ElfImage::getContent(const Section & section) const
+{
+	if (SHT_NOBITS == section.type || section.offset > size_ || section.size > size_ - section.offset) {
+		return std::string_view();
+	}
+	return std::string_view(reinterpret_cast<const char *>(data_ + section.offset), section.size);
+}
+
+std::string_view ElfImage::findSection(std::string_view name) const
+{
+	if (!isValid()) {
+		return std::string_view();
+	}
+	const std::string_view names = getContent(sections_[section_names_index_]);
+	for (const Section & section : sections_) {
+		if (section.name >= names.size()) {
+			continue;
+		}
+		std::string_view section_name = names.substr(section.name);
+		section_name = section_name.substr(0, section_name.find('\0'));
+		if (section_name == name) {
+			return getContent(section);
+		}
+	}
+	return std::string_view();
+}
+
+std::vector<std::string> ElfImage::getDynamicStrings(std::int64_t tag) const
+{
+	std::vector<std::string> strings;
+	for (const Section & section : sections_) {
+		if (SHT_DYNAMIC != section.type || section.link >= sections_.size()) {
+			continue;
+		}
+		const std::string_view dynamic = getContent(section);
+		const std::string_view dynamic_strings = getContent(sections_[section.link]);
+		const std::size_t entry_size = is_64_bit_ ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+		for (std::size_t offset = 0; offset + entry_size <= dynamic.size(); offset += entry_size) {
+			std::int64_t entry_tag;
+			std::uint64_t entry_value;
+			if (is_64_bit_) {
+				Elf64_Dyn entry;
+				std::memcpy(&entry, dynamic.data() + offset, sizeof(entry));
+				entry_tag = entry.d_tag;
+				entry_value = entry.d_un.d_val;
+			} else {
+				Elf32_Dyn entry;
+				std::memcpy(&entry, dynamic.data() + offset, sizeof(entry));
+				entry_tag = entry.d_tag;
+				entry_value = entry.d_un.d_val;
+			}
+			if (DT_NULL == entry_tag) {
+				break;
+			}
+			if (entry_tag == tag && entry_value < dynamic_strings.size()) {
+				const std::string_view value = dynamic_strings.substr(entry_value);
+				strings.emplace_back(value.substr(0, value.find('\0')));
+			}
+		}
+	}
+	return strings;
+}
+
+std::vector<std::string> ElfImage::getNeededLibraries() const
+{
+	return getDynamicStrings(DT_NEEDED);
+}
+
+std::vector<std::string> ElfImage::getLibrarySearchPaths() const
+{
+	std::vector<std::string> lists = getDynamicStrings(DT_RUNPATH);
+	if (lists.empty()) {
+		lists = getDynamicStrings(DT_RPATH);
+	}
+
+	const std::string::size_type slash = path_.rfind('/');
+	const std::string origin = std::string::npos == slash ? "." : path_.substr(0, slash);
+	std::vector<std::string> directories;
+	for (const std::string & list : lists) {
+		std::string::size_type begin = 0;
+		while (begin <= list.size()) {
+			std::string::size_type end = list.find(':', begin);
+			if (std::string::npos == end) {
+				end = list.size();
+			}
+			std::string directory = list.substr(begin, end - begin);
+			for (const char * token : {"${ORIGIN}", "$ORIGIN"}) {
+				for (std::string::size_type at; (at = directory.find(token)) != std::string::npos; ) {
+					directory.replace(at, std::strlen(token), origin);
+				}
+			}
+			if (!directory.empty()) {
+				directories.push_back(directory);
+			}
+			begin = end + 1;
+		}
+	}
+	return directories;
+}
+
+#else
+
+ElfImage::ElfImage(const std::string & path)
+	: path_(path), data_(nullptr), size_(0), is_64_bit_(false), section_names_index_(0)
+{
+}
+
+ElfImage::~ElfImage()
+{
+}
+
+std::string_view ElfImage::findSection(std::string_view) const
+{
+	return std::string_view();
+}
+
+std::vector<std::string> ElfImage::getNeededLibraries() const
+{
+	return std::vector<std::string>();
+}
+
+std::vector<std::string> ElfImage::getLibrarySearchPaths() const
+{
+	return std::vector<std::string>();
+}
+
+#endif
+
+} // namespace impl
+} // namespace plugin
@@ -0,0 +1,88 @@
+#ifndef PLUGIN_ELF_IMAGE_HPP_
+#define PLUGIN_ELF_IMAGE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "VisibilityControl.h"
+
+namespace plugin {
+namespace impl {
+
+/**
+ * @class ElfImage
+ * @brief Read-only mapping of an ELF file, to read metadata out of a library without loading it.
+ *
+ * Only the pages that are looked at are read from disk. Every offset is checked against the file size, so a
+ * truncated or foreign file simply looks empty. Files of the other byte order than the host's are not read, and
+ * nothing is read on platforms other than Linux.
+ */
+class ElfImage
+{
+public:
+  /**
+   * @brief Maps a file. isValid() tells whether it is a readable ELF file.
+   */
+  PLUGIN_LOADER_PUBLIC
+  explicit ElfImage(const std::string & path);
+
+  PLUGIN_LOADER_PUBLIC
+  ~ElfImage();
+
+  ElfImage(const ElfImage &) = delete;
+  ElfImage & operator=(const ElfImage &) = delete;
+
+  bool isValid() const {return !sections_.empty();}
+  const std::string & getPath() const {return path_;}
+
+  /**
+   * @brief Gets the content of a section by name
+   * @return The content, empty if there is no such section. It stays valid as long as this image.
+   */
+  PLUGIN_LOADER_PUBLIC
+  std::string_view findSection(std::string_view name) const;
+
+  /**
+   * @brief Gets the libraries the file was linked against (DT_NEEDED), as written: usually bare sonames
+   */
+  PLUGIN_LOADER_PUBLIC
+  std::vector<std::string> getNeededLibraries() const;
+
+  /**
+   * @brief Gets the directories the platform loader searches first for the needed libraries: DT_RUNPATH, or
+   * DT_RPATH if there is none, with $ORIGIN replaced by the directory of the file
+   */
+  PLUGIN_LOADER_PUBLIC
+  std::vector<std::string> getLibrarySearchPaths() const;
+
+private:
+  struct Section
+  {
+    std::uint32_t name;
+    std::uint32_t type;
+    std::uint32_t link;
+    std::uint64_t offset;
+    std::uint64_t size;
+  };
+
+  template<class FileHeader, class SectionHeader>
+  void readSections();
+
+  std::string_view getContent(const Section & section) const;
+  std::vector<std::string> getDynamicStrings(std::int64_t tag) const;
+
+  std::string path_;
+  const unsigned char * data_;
+  std::size_t size_;
+  bool is_64_bit_;
+  std::size_t section_names_index_;
+  std::vector<Section> sections_;
+};
+
+} // namespace impl
+} // namespace plugin
+
+#endif // PLUGIN_ELF_IMAGE_HPP_
@@ -0,0 +1,230 @@
+#ifndef PLUGIN_FLAT_HASH_MAP_HPP_
+#define PLUGIN_FLAT_HASH_MAP_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace plugin {
+namespace impl {
+
+/**
+ * @brief FNV-1a hash of a class or type name. Values 0 and 1 are reserved by FlatHashMap to mark empty and erased slots, so they are never returned.
+ */
+inline std::size_t hashName(std::string_view name)
+{
+	std::uint64_t hash = 14695981039346656037ULL;
+	for (char c : name) {
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 1099511628211ULL;
+	}
+	std::size_t result = static_cast<std::size_t>(hash ^ (hash >> 32));
+	return result < 2 ? result + 2 : result;
+}
+
+/**
+ * @class FlatHashMap
+ * @brief Open-addressing (linear probing) hash map keyed by name.
+ *
+ * Hashes are kept in their own dense array next to the entries, so a probe walks contiguous memory and only
+ * touches a key string when the full hash matches. Erase leaves a tombstone, which keeps iterators to other
+ * entries valid while erasing during a walk. Lookups take a std::string_view and never allocate.
+ */
+template<typename Value>
+class FlatHashMap
+{
+public:
+	typedef std::pair<std::string, Value> value_type;
+
+	template<typename Map, typename Entry>
+	class Iterator
+	{
+	public:
+		Iterator(Map * map, std::size_t index) : map_(map), index_(index) {skip();}
+
+		Entry & operator*() const {return map_->entries_[index_];}
+		Entry * operator->() const {return &map_->entries_[index_];}
+		Iterator & operator++() {++index_; skip(); return *this;}
+		bool operator==(const Iterator & other) const {return index_ == other.index_;}
+		bool operator!=(const Iterator & other) const {return index_ != other.index_;}
+
+		/**
+		 * @brief The precomputed hash of the key this iterator points at
+		 */
+		std::size_t hash() const {return map_->hashes_[index_];}
+
+	private:
+		friend class FlatHashMap;
+
+		void skip()
+		{
+			while (index_ < map_->hashes_.size() && map_->hashes_[index_] < OCCUPIED) {
+				++index_;
+			}
+		}
+
+		Map * map_;
+		std::size_t index_;
+	};
+
+	typedef Iterator<FlatHashMap, value_type> iterator;
+	typedef Iterator<const FlatHashMap, const value_type> const_iterator;
+
+	FlatHashMap() : size_(0), tombstones_(0) {}
+
+	iterator begin() {return iterator(this, 0);}
+	iterator end() {return iterator(this, hashes_.size());}
+	const_iterator begin() const {return const_iterator(this, 0);}
+	const_iterator end() const {return const_iterator(this, hashes_.size());}
+
+	std::size_t size() const {return size_;}
+	bool empty() const {return 0 == size_;}
+
+	/**
+	 * @brief Makes room for count entries without rehashing
+	 */
+	void reserve(std::size_t count)
+	{
+		std::size_t capacity = MIN_CAPACITY;
+		while (count * 4 >= capacity * 3) {
+			capacity *= 2;
+		}
+		if (capacity > hashes_.size()) {
+			rehash(capacity);
+		}
+	}
+
+	iterator find(std::string_view key) {return iterator(this, findIndex(key, hashName(key)));}
+	const_iterator find(std::string_view key) const {return const_iterator(this, findIndex(key, hashName(key)));}
+
+	/**
+	 * @brief Same as find() but with a hash the caller already computed with hashName()
+	 */
+	iterator find(std::string_view key, std::size_t hash) {return iterator(this, findIndex(key, hash));}
+	const_iterator find(std::string_view key, std::size_t hash) const {return const_iterator(this, findIndex(key, hash));}
+
+	Value & operator[](std::string_view key)
+	{
+		std::size_t hash = hashName(key);
+		std::size_t index = findIndex(key, hash);
+		if (index == hashes_.size()) {
+			index = insertIndex(key, hash);
+		}
+		return entries_[index].second;
+	}
+
+	/**
+	 * @brief Erases the entry the iterator points at
+	 * @return An iterator to the next entry
+	 */
+	iterator erase(iterator itr)
+	{
+		hashes_[itr.index_] = TOMBSTONE;
+		entries_[itr.index_] = value_type();
+		--size_;
+		++tombstones_;
+		++itr;
+		return itr;
+	}
+
+	std::size_t erase(std::string_view key)
+	{
+		iterator itr = find(key);
+		if (itr == end()) {
+			return 0;
+		}
+		erase(itr);
+		return 1;
+	}
+
+	void clear()
+	{
+		hashes_.clear();
+		entries_.clear();
+		size_ = 0;
+		tombstones_ = 0;
+	}
+
+private:
+	static constexpr std::size_t EMPTY = 0;
+	static constexpr std::size_t TOMBSTONE = 1;
+	static constexpr std::size_t OCCUPIED = 2;
+	static constexpr std::size_t MIN_CAPACITY = 16;
+
+	std::size_t findIndex(std::string_view key, std::size_t hash) const
+	{
+		if (hashes_.empty()) {
+			return 0;
+		}
+		std::size_t mask = hashes_.size() - 1;
+		for (std::size_t i = hash & mask; ; i = (i + 1) & mask) {
+			if (hashes_[i] == EMPTY) {
+				return hashes_.size();
+			}
+			if (hashes_[i] == hash && entries_[i].first == key) {
+				return i;
+			}
+		}
+	}
+
+	std::size_t insertIndex(std::string_view key, std::size_t hash)
+	{
+		if ((size_ + tombstones_ + 1) * 4 >= hashes_.size() * 3) {
+			// Grow only if live entries need it; otherwise just sweep tombstones
+			std::size_t capacity = hashes_.empty() ? MIN_CAPACITY : hashes_.size();
+			if ((size_ + 1) * 2 >= capacity) {
+				capacity *= 2;
+			}
+			rehash(capacity);
+		}
+		std::size_t mask = hashes_.size() - 1;
+		std::size_t i = hash & mask;
+		while (hashes_[i] >= OCCUPIED) {
+			i = (i + 1) & mask;
+		}
+		if (hashes_[i] == TOMBSTONE) {
+			--tombstones_;
+		}
+		hashes_[i] = hash;
+		entries_[i].first.assign(key.data(), key.size());
+		++size_;
+		return i;
+	}
+
+	void rehash(std::size_t capacity)
+	{
+		std::vector<std::size_t> old_hashes;
+		std::vector<value_type> old_entries;
+		old_hashes.swap(hashes_);
+		old_entries.swap(entries_);
+		hashes_.assign(capacity, EMPTY);
+		entries_.resize(capacity);
+		tombstones_ = 0;
+
+		std::size_t mask = capacity - 1;
+		for (std::size_t j = 0; j < old_hashes.size(); ++j) {
+			if (old_hashes[j] < OCCUPIED) {
+				continue;
+			}
+			std::size_t i = old_hashes[j] & mask;
+			while (hashes_[i] != EMPTY) {
+				i = (i + 1) & mask;
+			}
+			hashes_[i] = old_hashes[j];
+			entries_[i] = std::move(old_entries[j]);
+		}
+	}
+
+	std::vector<std::size_t> hashes_;
+	std::vector<value_type> entries_;
+	std::size_t size_;
+	std::size_t tombstones_;
+};
+
+} // namespace impl
+} // namespace plugin
+
+#endif // PLUGIN_FLAT_HASH_MAP_HPP_
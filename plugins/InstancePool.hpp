@@ -0,0 +1,277 @@
+#ifndef PLUGIN_INSTANCE_POOL_HPP_
+#define PLUGIN_INSTANCE_POOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PluginLoader.hpp"
+
+namespace plugin {
+
+/**
+ * @class InstancePool
+ * @brief Recycles instances of one plugin class instead of destroying and re-creating them.
+ *
+ * A released object is reset through the class's `void reset()` hook (@see AbstractMetaObject::reset()) and
+ * kept for the next acquire(); objects of classes without the hook are destroyed as usual. Idle objects sit in
+ * free lists sharded by thread, so a thread that acquires and releases on its own rarely contends with others.
+ * refill() constructs objects ahead of time, called by the owner or by the background thread started with
+ * startBackgroundRefill(), which keeps expensive constructors off the request path.
+ *
+ * Every object, idle or in use, counts as a managed instance of the PluginLoader, and the pool holds one more
+ * reference for its own lifetime: in on-demand mode the library is unloaded only once the pool is destroyed and
+ * its objects are gone. The pool must not outlive its PluginLoader, and acquired objects must be released
+ * before the pool is destroyed.
+ */
+template<class Base>
+class InstancePool
+{
+public:
+  /**
+   * @brief Deleter of acquired objects: hands them back to the pool
+   */
+  class Deleter
+  {
+  public:
+    Deleter() : pool_(nullptr) {}
+    explicit Deleter(InstancePool * pool) : pool_(pool) {}
+
+    void operator()(Base * obj) const {pool_->release(obj);}
+
+  private:
+    InstancePool * pool_;
+  };
+
+  typedef std::unique_ptr<Base, Deleter> Pointer;
+
+  /**
+   * @brief Resolves the class and keeps its library loaded for the lifetime of the pool
+   * @param loader - The PluginLoader creating the instances. Its library is loaded if it is not yet.
+   * @param class_name - The plugin class to pool (@see PluginLoader::getAvailableClasses())
+   * @param capacity - Number of idle objects refill() constructs and release() keeps at most. Concurrent
+   * releases may briefly exceed it.
+   * @throws CreateClassException if the class is not available to loader
+   */
+  InstancePool(PluginLoader * loader, const std::string & class_name, std::size_t capacity)
+  : loader_(loader), class_name_(class_name), factory_(nullptr), capacity_(capacity), idle_count_(0),
+    next_refill_shard_(0), background_refill_(false), refill_wanted_(false), stop_refill_(false)
+  {
+    Base * first = loader_->createRawInstance<Base>(class_name, true,
+      [this](const AbstractMetaObject<Base> & factory) {
+        factory_ = &factory;
+        return factory.create();
+      });
+    loader_->addPluginReference();
+    if (capacity_ > 0) {
+      push(getShardIndex(), first);
+    } else {
+      loader_->onPluginDeletion<Base>(first);
+    }
+  }
+
+  /**
+   * @brief Stops the background refill, destroys the idle objects and lets the library go
+   */
+  ~InstancePool()
+  {
+    {
+      std::unique_lock<std::mutex> lock(refill_mutex_);
+      stop_refill_ = true;
+    }
+    refill_condition_.notify_all();
+    if (refill_thread_.joinable()) {
+      refill_thread_.join();
+    }
+
+    for (Shard & shard : shards_) {
+      for (Base * obj : shard.idle) {
+        loader_->onPluginDeletion<Base>(obj);
+      }
+    }
+    // Last: in on-demand mode this may unload the library
+    loader_->releasePluginReference();
+  }
+
+  InstancePool(const InstancePool &) = delete;
+  InstancePool & operator=(const InstancePool &) = delete;
+
+  /**
+   * @brief Takes an idle object, preferably one released by the calling thread, or constructs a new one
+   * @return The object; destroying the pointer releases it back to the pool
+   */
+  Pointer acquire()
+  {
+    std::size_t home = getShardIndex();
+    Base * obj = pop(home);
+    for (std::size_t i = 1; nullptr == obj && i < SHARD_COUNT && idle_count_.load(std::memory_order_relaxed) > 0; ++i) {
+      obj = pop((home + i) % SHARD_COUNT);
+    }
+    if (background_refill_.load(std::memory_order_relaxed) &&
+      idle_count_.load(std::memory_order_relaxed) * 2 < capacity_)
+    {
+      {
+        std::unique_lock<std::mutex> lock(refill_mutex_);
+        refill_wanted_ = true;
+      }
+      refill_condition_.notify_one();
+    }
+    if (nullptr == obj) {
+      obj = create();
+    }
+    return Pointer(obj, Deleter(this));
+  }
+
+  /**
+   * @brief Constructs objects until capacity of them are idle
+   * @return The number of objects constructed
+   */
+  std::size_t refill()
+  {
+    std::size_t constructed = 0;
+    while (idle_count_.load(std::memory_order_relaxed) < capacity_) {
+      Base * obj = create();
+      push(next_refill_shard_.fetch_add(1, std::memory_order_relaxed) % SHARD_COUNT, obj);
+      ++constructed;
+    }
+    return constructed;
+  }
+
+  /**
+   * @brief Starts a thread that calls refill() now and whenever acquire() leaves less than half of capacity idle.
+   * It is stopped by the destructor. Calling this again has no effect.
+   */
+  void startBackgroundRefill()
+  {
+    std::unique_lock<std::mutex> lock(refill_mutex_);
+    if (refill_thread_.joinable()) {
+      return;
+    }
+    background_refill_.store(true, std::memory_order_relaxed);
+    refill_thread_ = std::thread([this]() {runBackgroundRefill();});
+  }
+
+  /**
+   * @brief Gets the number of idle objects ready to be acquired
+   */
+  std::size_t getIdleCount() const {return idle_count_.load(std::memory_order_relaxed);}
+
+  /**
+   * @brief Gets the capacity the pool was created with
+   */
+  std::size_t getCapacity() const {return capacity_;}
+
+  /**
+   * @brief Gets the name of the pooled class
+   */
+  const std::string & getClassName() const {return class_name_;}
+
+private:
+  static constexpr std::size_t SHARD_COUNT = 16;
+
+  /**
+   * @brief One free list. Padded to a cache line so threads on different shards do not share one.
+   */
+  struct alignas(64) Shard
+  {
+    std::mutex mutex;
+    std::vector<Base *> idle;
+  };
+
+  /**
+   * @brief Gets the shard of the calling thread. Threads are spread round-robin when they first use a pool.
+   */
+  static std::size_t getShardIndex()
+  {
+    static std::atomic<std::size_t> next_shard(0);
+    thread_local std::size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % SHARD_COUNT;
+    return shard;
+  }
+
+  /**
+   * @brief Constructs a new object. The factory stays valid without a registry read section because the pool
+   * keeps its library loaded.
+   */
+  Base * create()
+  {
+    Base * obj = factory_->create();
+    loader_->addPluginReference();
+    return obj;
+  }
+
+  void release(Base * obj)
+  {
+    if (nullptr == obj) {
+      return;
+    }
+    if (idle_count_.load(std::memory_order_relaxed) < capacity_ && factory_->reset(obj)) {
+      push(getShardIndex(), obj);
+    } else {
+      loader_->onPluginDeletion<Base>(obj);
+    }
+  }
+
+  void push(std::size_t shard_index, Base * obj)
+  {
+    Shard & shard = shards_[shard_index];
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    shard.idle.push_back(obj);
+    idle_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  Base * pop(std::size_t shard_index)
+  {
+    Shard & shard = shards_[shard_index];
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    if (shard.idle.empty()) {
+      return nullptr;
+    }
+    Base * obj = shard.idle.back();
+    shard.idle.pop_back();
+    idle_count_.fetch_sub(1, std::memory_order_relaxed);
+    return obj;
+  }
+
+  void runBackgroundRefill()
+  {
+    std::unique_lock<std::mutex> lock(refill_mutex_);
+    while (!stop_refill_) {
+      // Cleared before refilling so a request made meanwhile is not lost
+      refill_wanted_ = false;
+      lock.unlock();
+      try {
+        refill();
+      } catch (const std::exception & e) {
+        logError(
+          "plugin::InstancePool: Background refill of %s failed: %s", class_name_.c_str(), e.what());
+      }
+      lock.lock();
+      refill_condition_.wait(lock, [this]() {return stop_refill_ || refill_wanted_;});
+    }
+  }
+
+  PluginLoader * loader_;
+  std::string class_name_;
+  const AbstractMetaObject<Base> * factory_;
+  std::size_t capacity_;
+  Shard shards_[SHARD_COUNT];
+  std::atomic<std::size_t> idle_count_;
+  std::atomic<std::size_t> next_refill_shard_;
+
+  std::atomic<bool> background_refill_;
+  std::mutex refill_mutex_;
+  std::condition_variable refill_condition_;
+  bool refill_wanted_;
+  bool stop_refill_;
+  std::thread refill_thread_;
+};
+
+} // namespace plugin
+
+#endif // PLUGIN_INSTANCE_POOL_HPP_
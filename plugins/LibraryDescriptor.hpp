@@ -0,0 +1,71 @@
+#ifndef PLUGIN_LIBRARY_DESCRIPTOR_HPP_
+#define PLUGIN_LIBRARY_DESCRIPTOR_HPP_
+
+#include <cstddef>
+#include <string>
+#include <type_traits>
+
+#include "MetaObject.hpp"
+
+/// Name of the symbol through which a library exports its LibraryDescriptor
+#define PLUGIN_LOADER_LIBRARY_DESCRIPTOR_SYMBOL "plugin_loader_library_descriptor"
+
+/// Bumped whenever the layout of LibraryDescriptor or PluginDescriptor changes
+#define PLUGIN_LOADER_LIBRARY_DESCRIPTOR_VERSION 1u
+
+/// Name of the ELF section holding the class records of PLUGIN_LOADER_REGISTER_CLASS and friends
+#define PLUGIN_LOADER_CLASSES_SECTION "plugin_loader_classes"
+
+/// First field of each class record, bumped whenever the record layout changes
+#define PLUGIN_LOADER_CLASS_RECORD_TAG "plugin_loader_class 2"
+
+namespace plugin {
+
+/**
+ * @brief One class of a plugin library (@see PLUGIN_LOADER_REGISTER_LIBRARY). Constant-initialized, so listing a
+ * class costs nothing when the library is opened.
+ */
+struct PluginDescriptor
+{
+  const char * class_name;
+  const char * base_class_name;
+  /// Creates the MetaObject of the class, the way registerPlugin() does for PLUGIN_LOADER_REGISTER_CLASS
+  AbstractMetaObjectBase * (*make_factory)(const std::string & class_name, const std::string & base_class_name);
+};
+
+/**
+ * @brief The table of classes a plugin library exports under PLUGIN_LOADER_LIBRARY_DESCRIPTOR_SYMBOL.
+ * impl::loadLibrary() registers all of them at once right after opening the library.
+ */
+struct LibraryDescriptor
+{
+  unsigned version;
+  std::size_t class_count;
+  const PluginDescriptor * classes;
+};
+
+namespace impl {
+
+template<class Meta>
+AbstractMetaObjectBase * makePluginFactory(const std::string & class_name, const std::string & base_class_name)
+{
+  return new Meta(class_name, base_class_name);
+}
+
+} // namespace impl
+
+/**
+ * @brief Makes the PluginDescriptor of Derived
+ * @param Meta - The MetaObject type to create, e.g. an ArgumentMetaObject for classes taking constructor arguments
+ */
+template<class Derived, class Base, class Meta = MetaObject<Derived, Base>>
+constexpr PluginDescriptor makePluginDescriptor(const char * class_name, const char * base_class_name)
+{
+  static_assert(!std::is_same<Meta, MetaObject<Derived, Base>>::value || std::is_default_constructible<Derived>::value,
+    "Classes listed with PLUGIN_LOADER_LIBRARY_CLASS must be default constructible");
+  return PluginDescriptor{class_name, base_class_name, &impl::makePluginFactory<Meta>};
+}
+
+} // namespace plugin
+
+#endif // PLUGIN_LIBRARY_DESCRIPTOR_HPP_
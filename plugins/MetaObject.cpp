@@ -32,6 +32,7 @@
 
 #include "MetaObject.hpp"
 #include "PluginLoaderCore.hpp"
+#include "UsageProfile.hpp"
 
 namespace plugin
 {
@@ -40,7 +41,8 @@ AbstractMetaObjectBase::AbstractMetaObjectBase(
 	: associated_library_path_("Unknown"),
 	base_class_name_(base_class_name),
 	class_name_(class_name),
-	typeid_base_class_name_("UNSET")
+	typeid_base_class_name_("UNSET"),
+	creation_count_(0)
 {
 	logDebug(
 		"plugin_loader.impl.AbstractMetaObjectBase: "
@@ -50,6 +52,9 @@ AbstractMetaObjectBase::AbstractMetaObjectBase(
 
 AbstractMetaObjectBase::~AbstractMetaObjectBase()
 {
+	if (getCreationCount() > 0) {
+		UsageProfile::recordRetiredFactory(*this);
+	}
 	logDebug(
 		"plugin_loader.impl.AbstractMetaObjectBase: "
 		"Destroying MetaObject %p (base = %s, derived = %s, library path = %s)",
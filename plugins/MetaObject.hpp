@@ -35,10 +35,17 @@
 #ifndef PLUGIN_META_OBJECT_HPP_
 #define PLUGIN_META_OBJECT_HPP_
 
+#include "Exceptions.hpp"
 #include "VisibilityControl.h"
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
 #include <typeinfo>
+#include <type_traits>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace plugin
@@ -47,6 +54,32 @@ class PluginLoader;  // Forward declaration
 
 typedef std::vector<plugin::PluginLoader *> PluginLoaderVector;
 
+/**
+* @brief Detects the optional `void reset()` member a plugin class provides to be recycled by an InstancePool
+*/
+template<class C, class = void>
+struct HasResetHook : std::false_type {};
+
+template<class C>
+struct HasResetHook<C, std::void_t<decltype(std::declval<C &>().reset())>> : std::true_type {};
+
+/**
+* @brief Type-erased entry points of a class registered with constructor arguments
+* (@see PLUGIN_LOADER_REGISTER_CLASS_WITH_ARGS). The functions are stored as void (*)() and may only be cast
+* back to their real type once the caller's argument types compared equal to signature.
+*/
+struct ArgumentFactory
+{
+	typedef void (*Function)();
+
+	/// typeid(B * (Args...)) with every argument type decayed
+	const std::type_info * signature;
+	/// B * (*)(Args && ...): creates the object with new
+	Function create;
+	/// B * (*)(void * storage, Args && ...): constructs it in caller-provided storage, like construct()
+	Function construct;
+};
+
 /**
 * @class AbstractMetaObjectBase
 * @brief A base class for MetaObjects that excludes a polymorphic type parameter. Subclasses are class templates though.
@@ -125,6 +158,16 @@ public:
 	*/
 	PluginLoaderVector getAssociatedPluginLoaders() { return associated_plugin_loaders_; }
 
+	/**
+	* @brief Counts objects created through this factory, @see UsageProfile
+	*/
+	void countCreations(std::uint64_t count) const { creation_count_.fetch_add(count, std::memory_order_relaxed); }
+
+	/**
+	* @brief Gets the number of objects counted by countCreations()
+	*/
+	std::uint64_t getCreationCount() const { return creation_count_.load(std::memory_order_relaxed); }
+
 protected:
 	/**
 	* This is needed to make base class polymorphic (i.e. have a vtable)
@@ -137,6 +180,7 @@ protected:
 	std::string base_class_name_;
 	std::string class_name_;
 	std::string typeid_base_class_name_;
+	mutable std::atomic<std::uint64_t> creation_count_;
 };
 
 /**
@@ -166,6 +210,37 @@ public:
 	/// Create a new instance of a class.
 	/// Cannot be used for singletons.
 
+	/**
+	* @brief Gets sizeof() of the derived class, for callers that provide the storage to construct() into
+	*/
+	virtual std::size_t objectSize() const = 0;
+
+	/**
+	* @brief Gets alignof() of the derived class
+	*/
+	virtual std::size_t objectAlignment() const = 0;
+
+	/**
+	* @brief Constructs an object in caller-provided storage instead of on the heap.
+	* @param storage At least objectSize() bytes aligned to objectAlignment()
+	* @return A pointer of parametric type B to the new object. The caller destroys it through B's virtual destructor and then releases the storage itself.
+	*/
+	virtual B * construct(void * storage) const = 0;
+
+	/**
+	* @brief Runs the plugin's reset hook so a released object can be handed out again (@see InstancePool)
+	* @param obj An object created by this factory
+	* @return false if the class has no `void reset()` member, in which case the object must not be reused
+	*/
+	virtual bool reset(B * obj) const = 0;
+
+	/**
+	* @brief Gets the entry points taking constructor arguments
+	* @param signature typeid(B * (Args...)) of the decayed argument types the caller passes
+	* @return nullptr unless the class was registered with exactly that signature
+	*/
+	virtual const ArgumentFactory * findArgumentFactory(const std::type_info & signature) const = 0;
+
 private:
 	AbstractMetaObject();
 	AbstractMetaObject(const AbstractMetaObject &) = delete;
@@ -175,7 +250,7 @@ private:
 /**
 * @class MetaObject
 * @brief The actual factory.
-* @parm C The derived class (the actual plugin)
+* @parm C The derived class (the actual plugin), default constructible unless it is an ArgumentMetaObject
 * @parm B The base class interface for the plugin
 */
 template<class C, class B>
@@ -188,6 +263,9 @@ public:
 	MetaObject(const std::string & class_name, const std::string & base_class_name)
 		: AbstractMetaObject<B>(class_name, base_class_name)
 	{
+		static_assert(std::is_default_constructible<C>::value,
+			"Classes registered without constructor arguments must be default constructible, "
+			"register them with PLUGIN_LOADER_REGISTER_CLASS_WITH_ARGS or PLUGIN_LOADER_REGISTER_FACTORY");
 	}
 
 	/**
@@ -196,7 +274,127 @@ public:
 		*/
 	B * create() const
 	{
-		return new C;
+		if constexpr (std::is_default_constructible<C>::value) {
+			return new C;
+		} else {
+			// Only reachable through an ArgumentMetaObject, created without the arguments it needs
+			throw CreateClassException(this->className() + " cannot be created without constructor arguments");
+		}
+	}
+
+	std::size_t objectSize() const
+	{
+		return sizeof(C);
+	}
+
+	std::size_t objectAlignment() const
+	{
+		return alignof(C);
+	}
+
+	B * construct(void * storage) const
+	{
+		if constexpr (std::is_default_constructible<C>::value) {
+			return new (storage) C;
+		} else {
+			(void)storage;
+			// Only reachable through an ArgumentMetaObject, created without the arguments it needs
+			throw CreateClassException(this->className() + " cannot be created without constructor arguments");
+		}
+	}
+
+	bool reset(B * obj) const
+	{
+		if constexpr (HasResetHook<C>::value) {
+			static_cast<C *>(obj)->reset();
+			return true;
+		} else {
+			(void)obj;
+			return false;
+		}
+	}
+
+	const ArgumentFactory * findArgumentFactory(const std::type_info &) const
+	{
+		return nullptr;
+	}
+
+protected:
+	struct WithArguments {};
+
+	/**
+		* @brief Constructor of an ArgumentMetaObject, for which C needs no default constructor
+		*/
+	MetaObject(WithArguments, const std::string & class_name, const std::string & base_class_name)
+		: AbstractMetaObject<B>(class_name, base_class_name)
+	{
+	}
+};
+
+/**
+* @brief Arguments policy of ArgumentMetaObject: builds C with its constructor taking Args
+*/
+template<class C, class B, class... Args>
+struct ConstructorArguments
+{
+	typedef B * Signature(typename std::decay<Args>::type...);
+
+	static B * create(typename std::decay<Args>::type &&... args)
+	{
+		return new C(std::move(args)...);
+	}
+
+	static B * construct(void * storage, typename std::decay<Args>::type &&... args)
+	{
+		return new (storage) C(std::move(args)...);
+	}
+};
+
+/**
+* @brief Arguments policy of ArgumentMetaObject: builds C from what the factory function F returns by value
+*/
+template<class C, class B, class F, F Function>
+struct FunctionArguments;
+
+template<class C, class B, class... Args, C (*Function)(Args...)>
+struct FunctionArguments<C, B, C (*)(Args...), Function>
+{
+	typedef B * Signature(typename std::decay<Args>::type...);
+
+	static B * create(typename std::decay<Args>::type &&... args)
+	{
+		return new C(Function(std::move(args)...));
+	}
+
+	static B * construct(void * storage, typename std::decay<Args>::type &&... args)
+	{
+		return new (storage) C(Function(std::move(args)...));
+	}
+};
+
+/**
+* @class ArgumentMetaObject
+* @brief Factory of a class registered with constructor arguments. Arguments is ConstructorArguments or
+* FunctionArguments. Default construction through create() still works if C supports it.
+* Adds no data members: MetaObjects are deleted through the non-virtual AbstractMetaObjectBase destructor.
+*/
+template<class C, class B, class Arguments>
+class ArgumentMetaObject : public MetaObject<C, B>
+{
+public:
+	ArgumentMetaObject(const std::string & class_name, const std::string & base_class_name)
+		: MetaObject<C, B>(typename MetaObject<C, B>::WithArguments(), class_name, base_class_name)
+	{
+	}
+
+	const ArgumentFactory * findArgumentFactory(const std::type_info & signature) const
+	{
+		static const ArgumentFactory factory = {
+			&typeid(typename Arguments::Signature),
+			reinterpret_cast<ArgumentFactory::Function>(&Arguments::create),
+			reinterpret_cast<ArgumentFactory::Function>(&Arguments::construct)
+		};
+		return signature == *factory.signature ? &factory : nullptr;
 	}
 };
 
@@ -29,36 +29,162 @@
 
 #include "MultiLibraryPluginLoader.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <queue>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <vector>
 
 namespace plugin
 {
 
-MultiLibraryPluginLoader::MultiLibraryPluginLoader(bool enable_ondemand_loadunload)
-: enable_ondemand_loadunload_(enable_ondemand_loadunload)
+class MultiLibraryPluginLoader::BackgroundLoads
+{
+public:
+  explicit BackgroundLoads(std::size_t max_threads)
+  : max_threads_(std::max<std::size_t>(1, max_threads)), next_sequence_(0), running_(0)
+  {
+  }
+
+  ~BackgroundLoads()
+  {
+    stop();
+  }
+
+  // Queues a job, run after the queued jobs of higher priority and of the same priority queued before it
+  void submit(int priority, std::function<void()> job)
+  {
+    std::vector<std::thread> finished;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      // Reaped here rather than left joinable until wait()
+      for (const std::thread::id & id : finished_) {
+        auto itr = std::find_if(workers_.begin(), workers_.end(), [&id](const std::thread & worker) {
+              return worker.get_id() == id;
+            });
+        finished.push_back(std::move(*itr));
+        workers_.erase(itr);
+      }
+      finished_.clear();
+
+      jobs_.push(Job{priority, next_sequence_++, std::move(job)});
+      if (running_ < max_threads_) {
+        try {
+          workers_.emplace_back(&BackgroundLoads::work, this);
+          ++running_;
+        } catch (const std::system_error &) {
+          // The job stays queued: a running worker or the first user of the library runs it
+        }
+      }
+    }
+    for (auto & worker : finished) {
+      worker.join();
+    }
+  }
+
+  void wait()
+  {
+    std::vector<std::thread> workers;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      idle_.wait(lock, [this]() {return jobs_.empty() && 0 == running_;});
+      workers.swap(workers_);
+      finished_.clear();
+    }
+    for (auto & worker : workers) {
+      worker.join();
+    }
+  }
+
+  // Drops the jobs not started yet and waits for the others
+  void stop()
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      jobs_ = std::priority_queue<Job>();
+    }
+    wait();
+  }
+
+private:
+  struct Job
+  {
+    int priority;
+    std::uint64_t sequence;
+    std::function<void()> run;
+
+    bool operator<(const Job & other) const
+    {
+      return priority != other.priority ? priority < other.priority : sequence > other.sequence;
+    }
+  };
+
+  void work()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!jobs_.empty()) {
+      std::function<void()> job = std::move(const_cast<Job &>(jobs_.top()).run);
+      jobs_.pop();
+      lock.unlock();
+      job();
+      lock.lock();
+    }
+    finished_.push_back(std::this_thread::get_id());
+    if (0 == --running_) {
+      idle_.notify_all();
+    }
+  }
+
+  const std::size_t max_threads_;
+  std::mutex mutex_;
+  std::condition_variable idle_;
+  std::priority_queue<Job> jobs_;
+  std::uint64_t next_sequence_;
+  std::size_t running_;
+  std::vector<std::thread> workers_;
+  std::vector<std::thread::id> finished_;  // Workers of workers_ that are returning, to be joined
+};
+
+MultiLibraryPluginLoader::MultiLibraryPluginLoader(bool enable_ondemand_loadunload, bool use_manifests)
+: enable_ondemand_loadunload_(enable_ondemand_loadunload), use_manifests_(use_manifests),
+  plugin_index_(nullptr)
 {
 }
 
 MultiLibraryPluginLoader::~MultiLibraryPluginLoader()
 {
+  // The queued loads use the loaders
+  background_loads_.reset();
   shutdownAllPluginLoaders();
+  collectRetiredGenerations();
+  for (auto & retired : retired_generations_) {
+    logWarn(
+      "plugin::MultiLibraryPluginLoader: Generation %u of library %s still has instances, it stays loaded.",
+      retired.second.number, retired.first.c_str());
+  }
 }
 
 std::vector<std::string> MultiLibraryPluginLoader::getRegisteredLibraries()
 {
   std::vector<std::string> libraries;
-  for (auto & it : active_plugin_loaders_) {
-    if (it.second != nullptr) {
-      libraries.push_back(it.first);
-    }
-  }
+  forEachRegisteredLibrary([&libraries](std::string_view library_path) {
+    libraries.emplace_back(library_path);
+  });
   return libraries;
 }
 
 PluginLoader * MultiLibraryPluginLoader::getPluginLoaderForLibrary(const std::string & library_path)
 {
+  std::unique_lock<std::mutex> lock(loader_mutex_);
   LibraryToPluginLoaderMap::iterator itr = active_plugin_loaders_.find(library_path);
   if (itr != active_plugin_loaders_.end()) {
     return itr->second;
@@ -68,6 +194,7 @@ PluginLoader * MultiLibraryPluginLoader::getPluginLoaderForLibrary(const std::st
 PluginLoaderVector MultiLibraryPluginLoader::getAllAvailablePluginLoaders()
 {
   PluginLoaderVector loaders;
+  std::unique_lock<std::mutex> lock(loader_mutex_);
   for (auto & it : active_plugin_loaders_) {
     loaders.push_back(it.second);
   }
@@ -79,11 +206,367 @@ bool MultiLibraryPluginLoader::isLibraryAvailable(const std::string & library_na
   return getPluginLoaderForLibrary(library_name) != nullptr;
 }
 
-void MultiLibraryPluginLoader::loadLibrary(const std::string & library_path)
+void MultiLibraryPluginLoader::loadLibrary(
+  const std::string & library_path, const SharedLibrary::LoadOptions & load_options)
 {
-  if (!isLibraryAvailable(library_path)) {
-    active_plugin_loaders_[library_path] =
-      new plugin::PluginLoader(library_path, isOnDemandLoadUnloadEnabled());
+  if (isLibraryAvailable(library_path)) {
+    return;
+  }
+  // Loaded with loader_mutex_ released
+  PluginLoader * loader =
+    new plugin::PluginLoader(library_path, isOnDemandLoadUnloadEnabled(), load_options);
+  if (use_manifests_) {
+    loader->loadManifest();
+  }
+  if (!addPluginLoader(library_path, loader)) {
+    delete loader;
+  }
+}
+
+bool MultiLibraryPluginLoader::addPluginLoader(const std::string & library_path, PluginLoader * loader)
+{
+  std::unique_lock<std::mutex> lock(loader_mutex_);
+  PluginLoader *& entry = active_plugin_loaders_[library_path];
+  if (entry != nullptr) {
+    return false;
+  }
+  entry = loader;
+  return true;
+}
+
+LibraryLoadErrors MultiLibraryPluginLoader::loadLibraries(
+  const std::vector<std::string> & library_paths, const SharedLibrary::LoadOptions & load_options,
+  std::size_t max_threads)
+{
+  std::vector<std::string> pending;
+  for (auto & library_path : library_paths) {
+    if (!isLibraryAvailable(library_path) &&
+      std::find(pending.begin(), pending.end(), library_path) == pending.end())
+    {
+      pending.push_back(library_path);
+    }
+  }
+
+  std::vector<PluginLoader *> loaders(pending.size(), nullptr);
+  std::vector<std::string> errors(pending.size());
+  std::atomic<std::size_t> next(0);
+  const bool ondemand = isOnDemandLoadUnloadEnabled();
+  const bool use_manifests = use_manifests_;
+  auto work = [&]() {
+      // Each load only marks the registry dirty; the batch is published once below
+      impl::DeferredSnapshotGuard deferred;
+      for (std::size_t i; (i = next.fetch_add(1)) < pending.size(); ) {
+        try {
+          loaders[i] = new plugin::PluginLoader(pending[i], ondemand, load_options);
+          if (use_manifests) {
+            loaders[i]->loadManifest();
+          }
+        } catch (const std::exception & e) {
+          errors[i] = e.what();
+        }
+      }
+    };
+
+  if (0 == max_threads) {
+    max_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  std::vector<std::thread> workers;
+  for (std::size_t i = 1; i < std::min(max_threads, pending.size()); ++i) {
+    try {
+      workers.emplace_back(work);
+    } catch (const std::system_error &) {
+      break;  // The workers already started and this thread take over
+    }
+  }
+  work();
+  for (auto & worker : workers) {
+    worker.join();
+  }
+  impl::publishFactoryMapSnapshots();
+
+  LibraryLoadErrors failures;
+  for (std::size_t i = 0; i < pending.size(); ++i) {
+    if (loaders[i] != nullptr) {
+      if (!addPluginLoader(pending[i], loaders[i])) {
+        delete loaders[i];
+      }
+    } else {
+      logWarn(
+        "plugin::MultiLibraryPluginLoader: Could not load library %s: %s",
+        pending[i].c_str(), errors[i].c_str());
+      failures[pending[i]] = errors[i];
+    }
+  }
+  return failures;
+}
+
+LibraryLoadErrors MultiLibraryPluginLoader::loadPlan(
+  const std::vector<PlannedLibrary> & plan, int critical_priority,
+  const SharedLibrary::LoadOptions & load_options, std::size_t max_threads)
+{
+  std::vector<PlannedLibrary> pending;
+  for (auto & library : plan) {
+    auto itr = std::find_if(pending.begin(), pending.end(), [&library](const PlannedLibrary & other) {
+          return other.library_path == library.library_path;
+        });
+    if (itr != pending.end()) {
+      itr->priority = std::max(itr->priority, library.priority);
+    } else if (!isLibraryAvailable(library.library_path)) {
+      pending.push_back(library);
+    }
+  }
+  std::stable_sort(pending.begin(), pending.end(), [](const PlannedLibrary & a, const PlannedLibrary & b) {
+      return a.priority > b.priority;
+    });
+
+  std::vector<std::string> critical;
+  auto first_deferred = pending.begin();
+  for (; first_deferred != pending.end() && first_deferred->priority >= critical_priority; ++first_deferred) {
+    critical.push_back(first_deferred->library_path);
+  }
+  LibraryLoadErrors failures = loadLibraries(critical, load_options, max_threads);
+
+  if (isOnDemandLoadUnloadEnabled()) {
+    // Nothing is opened ahead of use in this mode
+    for (auto itr = first_deferred; itr != pending.end(); ++itr) {
+      loadLibrary(itr->library_path, load_options);
+    }
+    return failures;
+  }
+
+  BackgroundLoads * background_loads = nullptr;
+  if (first_deferred != pending.end()) {
+    std::unique_lock<std::mutex> lock(loader_mutex_);
+    if (!background_loads_) {
+      if (0 == max_threads) {
+        max_threads = std::max(1u, std::thread::hardware_concurrency());
+      }
+      background_loads_.reset(new BackgroundLoads(max_threads));
+    }
+    background_loads = background_loads_.get();
+  }
+  for (auto itr = first_deferred; itr != pending.end(); ++itr) {
+    PluginLoader * loader = new plugin::PluginLoader(
+      PluginLoader::DeferLoad(), itr->library_path, false, load_options);
+    if (use_manifests_) {
+      loader->loadManifest();
+    }
+    if (!addPluginLoader(itr->library_path, loader)) {
+      delete loader;
+      continue;
+    }
+    const int priority = itr->priority;
+    loader->loadLibraryAsync([background_loads, priority](std::function<void()> job) {
+        background_loads->submit(priority, std::move(job));
+      });
+  }
+  return failures;
+}
+
+void MultiLibraryPluginLoader::loadWithProfile(
+  const std::vector<std::string> & library_paths, const UsageProfile & profile,
+  const SharedLibrary::LoadOptions & load_options, std::size_t max_threads)
+{
+  std::vector<PlannedLibrary> hot;
+  std::vector<std::string> cold;
+  for (auto & library_path : library_paths) {
+    if (isLibraryAvailable(library_path) ||
+      std::find(cold.begin(), cold.end(), library_path) != cold.end())
+    {
+      continue;
+    }
+    const UsageProfile::LibraryUsage * usage = profile.findLibrary(library_path);
+    const std::uint64_t creations = usage != nullptr ? usage->getCreations() : 0;
+    if (creations > 0) {
+      // Below the critical priority: nothing is loaded before returning
+      const std::uint64_t max_priority = std::numeric_limits<int>::max() - 1;
+      hot.push_back(PlannedLibrary{library_path, static_cast<int>(std::min(creations, max_priority))});
+    } else {
+      cold.push_back(library_path);
+    }
+  }
+
+  if (isOnDemandLoadUnloadEnabled()) {
+    for (auto & library_path : library_paths) {
+      loadLibrary(library_path, load_options);
+    }
+    return;
+  }
+
+  loadPlan(hot, std::numeric_limits<int>::max(), load_options, max_threads);
+  for (auto & library_path : cold) {
+    // Not loaded: the first instance created from it, or a class lookup without manifest, does
+    PluginLoader * loader = new plugin::PluginLoader(PluginLoader::DeferLoad(), library_path, false, load_options);
+    if (use_manifests_) {
+      loader->loadManifest();
+    }
+    if (!addPluginLoader(library_path, loader)) {
+      delete loader;
+    }
+  }
+}
+
+void MultiLibraryPluginLoader::waitForBackgroundLoads()
+{
+  BackgroundLoads * background_loads = nullptr;
+  {
+    std::unique_lock<std::mutex> lock(loader_mutex_);
+    background_loads = background_loads_.get();
+  }
+  // Kept until destruction once created
+  if (background_loads != nullptr) {
+    background_loads->wait();
+  }
+}
+
+unsigned MultiLibraryPluginLoader::reloadLibrary(const std::string & library_path)
+{
+  collectRetiredGenerations();
+  // Held throughout: no concurrent unloadLibrary() destroys current meanwhile
+  std::unique_lock<std::mutex> generation_lock(generation_mutex_);
+  PluginLoader * current = getPluginLoaderForLibrary(library_path);
+  if (nullptr == current) {
+    throw plugin::NoPluginLoaderExistsException(
+            "Could not reload library " + library_path + " as there is no PluginLoader in "
+            "MultiLibraryPluginLoader bound to it. Ensure you called MultiLibraryPluginLoader::loadLibrary()");
+  }
+  if (current->load_options_.scope != SharedLibrary::SCOPE_LOCAL) {
+    throw plugin::LibraryLoadException(
+            "Could not reload library " + library_path + " as it was not loaded with SharedLibrary::SCOPE_LOCAL");
+  }
+  // A queued background load must not run after the loader is retired
+  current->waitForPendingLoads();
+
+  Generation previous{current, 0, library_path};
+  auto generation_itr = generations_.find(library_path);
+  if (generation_itr != generations_.end()) {
+    previous = generation_itr->second;
+  }
+  const unsigned number = previous.number + 1;
+
+  // A fresh file each time: the platform loader hands back the running image for a path it already opened, and
+  // writing over a file that is mapped corrupts it. Next to the library, so that $ORIGIN still resolves.
+  const std::string base_image_path = library_path + ".generation" + std::to_string(number);
+  std::string image_path = base_image_path;
+  std::error_code error;
+  for (unsigned attempt = 1; std::filesystem::exists(image_path, error); ++attempt) {
+    image_path = base_image_path + "." + std::to_string(attempt);
+  }
+  if (!std::filesystem::copy_file(library_path, image_path, error)) {
+    throw plugin::LibraryLoadException(
+            "Could not copy library " + library_path + " to " + image_path + ": " + error.message());
+  }
+
+  // Its factories then replace those of the running generation instead of colliding with them
+  impl::registerLibraryGeneration(image_path, library_path);
+  PluginLoader * loader = nullptr;
+  try {
+    loader = new plugin::PluginLoader(image_path, isOnDemandLoadUnloadEnabled(), current->load_options_);
+    if (use_manifests_) {
+      loader->loadManifest();
+    }
+  } catch (...) {
+    delete loader;
+    impl::unregisterLibraryGeneration(image_path);
+    std::filesystem::remove(image_path, error);
+    throw;
+  }
+
+  // The registry already hands out the factories of the new generation, now so does this class loader
+  {
+    std::unique_lock<std::mutex> lock(loader_mutex_);
+    active_plugin_loaders_[library_path] = loader;
+    removePluginLoaderFromClassIndex(current);
+  }
+  generations_[library_path] = Generation{loader, number, image_path};
+  retired_generations_.emplace_back(library_path, previous);
+  current->retire();
+  GenerationVector finished = takeFinishedGenerations();
+  generation_lock.unlock();
+
+  destroyGenerations(finished);
+  return number;
+}
+
+void MultiLibraryPluginLoader::collectRetiredGenerations()
+{
+  std::unique_lock<std::mutex> generation_lock(generation_mutex_);
+  GenerationVector finished = takeFinishedGenerations();
+  generation_lock.unlock();
+  destroyGenerations(finished);
+}
+
+MultiLibraryPluginLoader::GenerationVector MultiLibraryPluginLoader::takeFinishedGenerations()
+{
+  GenerationVector finished;
+  auto itr = retired_generations_.begin();
+  while (itr != retired_generations_.end()) {
+    if (itr->second.loader->isRetirementComplete()) {
+      finished.push_back(std::move(*itr));
+      itr = retired_generations_.erase(itr);
+    } else {
+      ++itr;
+    }
+  }
+  return finished;
+}
+
+void MultiLibraryPluginLoader::destroyGenerations(const GenerationVector & generations)
+{
+  for (auto & generation : generations) {
+    delete generation.second.loader;
+    removeGenerationImage(generation.first, generation.second);
+  }
+}
+
+void MultiLibraryPluginLoader::removeGenerationImage(
+  const LibraryPath & library_path, const Generation & generation)
+{
+  if (generation.image_path != library_path) {
+    impl::unregisterLibraryGeneration(generation.image_path);
+    std::error_code error;
+    std::filesystem::remove(generation.image_path, error);
+  }
+}
+
+LibraryLoadErrors MultiLibraryPluginLoader::loadDirectory(
+  const std::string & directory, const std::string & pattern,
+  const SharedLibrary::LoadOptions & load_options, std::size_t max_threads)
+{
+  std::vector<std::string> library_paths;
+  std::error_code error;
+  for (std::filesystem::directory_iterator itr(directory, error), end; !error && itr != end; itr.increment(error)) {
+    const std::string file_name = itr->path().filename().string();
+    std::error_code status_error;
+    if (PluginIndex::matchesPattern(file_name, pattern) && itr->is_regular_file(status_error)) {
+      library_paths.push_back((std::filesystem::path(directory) / file_name).string());
+    }
+  }
+  if (error) {
+    throw plugin::LibraryLoadException(
+      "Could not read plugin directory " + directory + ": " + error.message());
+  }
+  std::sort(library_paths.begin(), library_paths.end());
+  return loadLibraries(library_paths, load_options, max_threads);
+}
+
+MultiLibraryPluginLoader::ClassIndex &
+MultiLibraryPluginLoader::getClassIndexForBaseClass(const std::string & typeid_base_class_name)
+{
+  return class_index_[typeid_base_class_name];
+}
+
+void MultiLibraryPluginLoader::removePluginLoaderFromClassIndex(PluginLoader * loader)
+{
+  for (auto & base : class_index_) {
+    ClassIndex & index = base.second;
+    auto itr = index.classes.begin();
+    while (itr != index.classes.end()) {
+      itr = (itr->second == loader) ? index.classes.erase(itr) : ++itr;
+    }
+    index.indexed_loaders.erase(
+      std::remove(index.indexed_loaders.begin(), index.indexed_loaders.end(), loader),
+      index.indexed_loaders.end());
   }
 }
 
@@ -99,14 +582,37 @@ void MultiLibraryPluginLoader::shutdownAllPluginLoaders()
 int MultiLibraryPluginLoader::unloadLibrary(const std::string & library_path)
 {
   int remaining_unloads = 0;
-  LibraryToPluginLoaderMap::iterator itr = active_plugin_loaders_.find(library_path);
-  if (itr != active_plugin_loaders_.end()) {
-    PluginLoader * loader = itr->second;
-    if (0 == (remaining_unloads = loader->unloadLibrary())) {
-      delete (loader);
-      active_plugin_loaders_.erase(itr);
+  PluginLoader * destroyed = nullptr;
+  Generation generation{nullptr, 0, library_path};
+  GenerationVector finished;
+  {
+    // Concurrent unloads and reloads wait here, so the loader cannot be destroyed under this one
+    std::unique_lock<std::mutex> generation_lock(generation_mutex_);
+    PluginLoader * loader = getPluginLoaderForLibrary(library_path);
+    // Unloaded with loader_mutex_ released
+    if (loader != nullptr && 0 == (remaining_unloads = loader->unloadLibrary())) {
+      std::unique_lock<std::mutex> lock(loader_mutex_);
+      LibraryToPluginLoaderMap::iterator itr = active_plugin_loaders_.find(library_path);
+      if (itr != active_plugin_loaders_.end() && itr->second == loader) {
+        active_plugin_loaders_.erase(itr);
+        removePluginLoaderFromClassIndex(loader);
+        destroyed = loader;
+      }
     }
+    if (destroyed != nullptr) {
+      auto generation_itr = generations_.find(library_path);
+      if (generation_itr != generations_.end()) {
+        generation = generation_itr->second;
+        generations_.erase(generation_itr);
+      }
+    }
+    finished = takeFinishedGenerations();
+  }
+  if (destroyed != nullptr) {
+    delete (destroyed);
+    removeGenerationImage(library_path, generation);
   }
+  destroyGenerations(finished);
   return remaining_unloads;
 }
 
@@ -34,11 +34,18 @@
 
 #include <mutex>
 #include <cstddef>
+#include <algorithm>
 #include <map>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <typeinfo>
+#include <utility>
 #include <vector>
 
+#include "PluginIndex.hpp"
 #include "PluginLoader.hpp"
+#include "UsageProfile.hpp"
 #include "VisibilityControl.h"
 
 namespace plugin
@@ -47,6 +54,17 @@ namespace plugin
 typedef std::string LibraryPath;
 typedef std::map<LibraryPath, plugin::PluginLoader *> LibraryToPluginLoaderMap;
 typedef std::vector<PluginLoader *> PluginLoaderVector;
+/// Error message of each library a batch failed to load, @see MultiLibraryPluginLoader::loadLibraries()
+typedef std::map<LibraryPath, std::string> LibraryLoadErrors;
+
+/**
+ * @brief A library of a load plan, @see MultiLibraryPluginLoader::loadPlan()
+ */
+struct PlannedLibrary
+{
+  std::string library_path;
+  int priority;  // Higher loads first
+};
 
 /**
 * @class MultiLibraryPluginLoader
@@ -58,8 +76,10 @@ public:
   /**
    * @brief Constructor for the class
    * @param enable_ondemand_loadunload - Flag indicates if classes are to be loaded/unloaded automatically as plugin are created and destroyed
+   * @param use_manifests - Read the manifest of each library (@see PluginLoader::loadManifest()). With on-demand
+   * loading, classes are then found without opening any library; only the one a class is created from is loaded.
    */
-  explicit MultiLibraryPluginLoader(bool enable_ondemand_loadunload);
+  explicit MultiLibraryPluginLoader(bool enable_ondemand_loadunload, bool use_manifests = false);
 
   /**
   * @brief Virtual destructor for class
@@ -241,11 +261,15 @@ public:
    * @return true if loaded, false otherwise
    */
   template<class Base>
-  bool isClassAvailable(const std::string & class_name)
+  bool isClassAvailable(std::string_view class_name)
   {
-    std::vector<std::string> available_classes = getAvailableClasses<Base>();
-    return available_classes.end() != std::find(
-      available_classes.begin(), available_classes.end(), class_name);
+    std::unique_lock<std::mutex> lock(loader_mutex_);
+    for (auto & it : active_plugin_loaders_) {
+      if (it.second->isClassAvailable<Base>(class_name)) {
+        return true;
+      }
+    }
+    return false;
   }
 
   /**
@@ -264,14 +288,27 @@ public:
   std::vector<std::string> getAvailableClasses()
   {
     std::vector<std::string> available_classes;
-    for (auto & loader : getAllAvailablePluginLoaders()) {
-      std::vector<std::string> loader_classes = loader->getAvailableClasses<Base>();
-      available_classes.insert(
-        available_classes.end(), loader_classes.begin(), loader_classes.end());
-    }
+    forEachAvailableClass<Base>([&available_classes](std::string_view class_name) {
+      available_classes.emplace_back(class_name);
+    });
     return available_classes;
   }
 
+  /**
+   * @brief Visits the classes getAvailableClasses() would return without copying them
+   * @param Base - polymorphic type indicating Base class
+   * @param visit - Callable taking a std::string_view, valid only during the call. It must not load or unload libraries,
+   * nor call this class loader, which it runs locked.
+   */
+  template<class Base, class Visitor>
+  void forEachAvailableClass(Visitor && visit)
+  {
+    std::unique_lock<std::mutex> lock(loader_mutex_);
+    for (auto & it : active_plugin_loaders_) {
+      it.second->forEachAvailableClass<Base>(visit);
+    }
+  }
+
   /**
    * @brief Gets a list of all classes loaded for a particular library
    * @param Base - polymorphic type indicating Base class
@@ -296,11 +333,121 @@ public:
    */
   std::vector<std::string> getRegisteredLibraries();
 
+  /**
+   * @brief Visits the libraries getRegisteredLibraries() would return without copying them
+   * @param visit - Callable taking a std::string_view, valid only during the call. It must not call this class
+   * loader, which it runs locked.
+   */
+  template<class Visitor>
+  void forEachRegisteredLibrary(Visitor && visit)
+  {
+    std::unique_lock<std::mutex> lock(loader_mutex_);
+    for (auto & it : active_plugin_loaders_) {
+      if (it.second != nullptr) {
+        visit(std::string_view(it.first));
+      }
+    }
+  }
+
   /**
    * @brief Loads a library into memory for this class loader
    * @param library_path - the fully qualified path to the runtime library
+   * @param load_options - binding and symbol scope used when the library is opened
+   */
+  void loadLibrary(
+    const std::string & library_path,
+    const SharedLibrary::LoadOptions & load_options = SharedLibrary::LoadOptions());
+
+  /**
+   * @brief Loads several libraries for this class loader with a bounded pool of worker threads. A library that
+   * fails does not stop the others: its error is returned and it is left out of this class loader.
+   * The registrations of the whole batch are published to readers in one step once every library is loaded.
+   * With on-demand loading enabled nothing is opened here, as with loadLibrary().
+   * @param library_paths - the fully qualified paths to the runtime libraries; already loaded ones are skipped
+   * @param load_options - binding and symbol scope used when the libraries are opened
+   * @param max_threads - the number of workers, 0 for std::thread::hardware_concurrency()
+   * @return The libraries that could not be loaded, with their error message
+   */
+  LibraryLoadErrors loadLibraries(
+    const std::vector<std::string> & library_paths,
+    const SharedLibrary::LoadOptions & load_options = SharedLibrary::LoadOptions(),
+    std::size_t max_threads = 0);
+
+  /**
+   * @brief Loads every library of a directory whose file name matches a pattern, @see loadLibraries()
+   * @param directory - the directory to look into, not recursively
+   * @param pattern - file name pattern where '*' matches any run of characters and '?' any one character,
+   * e.g. "*" + SharedLibrary::suffix()
+   * @throws LibraryLoadException if the directory cannot be read
+   */
+  LibraryLoadErrors loadDirectory(
+    const std::string & directory, const std::string & pattern,
+    const SharedLibrary::LoadOptions & load_options = SharedLibrary::LoadOptions(),
+    std::size_t max_threads = 0);
+
+  /**
+   * @brief Loads the libraries of a plan by priority: those at or above critical_priority are loaded before
+   * returning (@see loadLibraries()), the others are queued and loaded in the background by at most max_threads
+   * workers, highest priority first. They are available right away: creating an instance of one of their classes
+   * waits for that library only, loading it on the calling thread if no worker got to it yet. A class is looked up
+   * in the libraries already loaded and in the manifests first, so without manifests a class of a queued library
+   * makes the queued libraries before it load too.
+   * With on-demand loading enabled nothing is opened here, as with loadLibrary().
+   * @param plan - the libraries with their priority; already loaded ones are skipped
+   * @param critical_priority - the lowest priority loaded before returning
+   * @param load_options - binding and symbol scope used when the libraries are opened
+   * @param max_threads - the number of workers, 0 for std::thread::hardware_concurrency()
+   * @return The critical libraries that could not be loaded, with their error message. A queued library that cannot
+   * be loaded stays registered and its error is thrown on first use.
    */
-  void loadLibrary(const std::string & library_path);
+  LibraryLoadErrors loadPlan(
+    const std::vector<PlannedLibrary> & plan, int critical_priority,
+    const SharedLibrary::LoadOptions & load_options = SharedLibrary::LoadOptions(),
+    std::size_t max_threads = 0);
+
+  /**
+   * @brief Warm start from the profile of a previous run (@see UsageProfile): the libraries objects were created
+   * from are loaded in the background, most used first (@see loadPlan()), while the others are only registered and
+   * opened on first use. With manifests a class of a cold library is found without opening it.
+   * With on-demand loading enabled nothing is opened here, as with loadLibrary().
+   * @param library_paths - the fully qualified paths to the runtime libraries; already loaded ones are skipped
+   * @param profile - the usage of the previous run; libraries missing from it are cold
+   * @param load_options - binding and symbol scope used when the libraries are opened
+   * @param max_threads - the number of workers, 0 for std::thread::hardware_concurrency()
+   */
+  void loadWithProfile(
+    const std::vector<std::string> & library_paths, const UsageProfile & profile,
+    const SharedLibrary::LoadOptions & load_options = SharedLibrary::LoadOptions(),
+    std::size_t max_threads = 0);
+
+  /**
+   * @brief Waits until the libraries queued by loadPlan() are all loaded, or failed to
+   */
+  void waitForBackgroundLoads();
+
+  /**
+   * @brief Resolves the classes no registered library provides through a directory index: the library the index
+   * names is then loaded with loadLibrary(), without probing the libraries that are not loaded yet.
+   * @param index - the index, which must outlive this class loader, nullptr to stop using it
+   */
+  void setPluginIndex(const PluginIndex * index) {plugin_index_ = index;}
+
+  /**
+   * @brief Replaces a library with the build now at its path, without waiting for its instances to go away.
+   * The file is copied next to it and the copy loaded side by side with the running generation. Its factories then
+   * replace those of the running generation for every new instance, created by class name or by library_path. The
+   * running generation keeps serving the instances it created and is closed, along with its factories, after the last
+   * of them dies. The copy is removed once its generation is closed.
+   * The library must have been loaded with SharedLibrary::SCOPE_LOCAL, as are its generations: the symbols of a
+   * global library would take precedence over the ones of the copy, which would then run the old code.
+   * Instances created with createUnmanagedInstance() keep their generation open forever.
+   * @param library_path - the fully qualified path to a runtime library loaded through this class loader
+   * @return The number of the new generation, the library as first loaded being generation 0
+   * @throws NoPluginLoaderExistsException if the library was not loaded through this class loader
+   * @throws LibraryLoadException if it was loaded with SharedLibrary::SCOPE_GLOBAL, or if the new build cannot be
+   * copied or loaded, in which case nothing changes
+   */
+  unsigned reloadLibrary(const std::string & library_path);
 
   /**
    * @brief Unloads a library for this class loader
@@ -321,26 +468,118 @@ private:
    */
   PluginLoader * getPluginLoaderForLibrary(const std::string & library_path);
 
+  /**
+   * @brief Binds a loader to a library unless another one got bound to it first
+   * @return false if the library already had a loader, in which case the caller still owns loader
+   */
+  bool addPluginLoader(const std::string & library_path, PluginLoader * loader);
+
   /**
    * @brief Gets a handle to the class loader corresponding to a specific class
+   * Answered from the class index when possible. On a miss only the loaders not yet indexed for Base are
+   * probed (loading their library if needed and there is no manifest), and each probed loader is indexed on the way.
+   * Loaders without a manifest to answer from are probed last if they still wait for a background load, and
+   * after those if their library is not loaded at all. Before those, the plugin index is asked, if any. Libraries
+   * are loaded, and background loads waited for, with loader_mutex_ released.
    * @param class_name - name of class for which we want to create instance
    * @return A pointer to the PluginLoader*, == nullptr if not found
    */
   template<typename Base>
   PluginLoader * getPluginLoaderForClass(const std::string & class_name)
   {
-    PluginLoaderVector loaders = getAllAvailablePluginLoaders();
-    for (PluginLoaderVector::iterator i = loaders.begin(); i != loaders.end(); ++i) {
-      if (!(*i)->isLibraryLoaded()) {
-        (*i)->loadLibrary();
+    enum ProbeCost {ANSWERED, PENDING, UNLOADED};
+    bool index_asked = false;
+    std::unique_lock<std::mutex> lock(loader_mutex_);
+    for (;;) {
+      // Looked up again after each load, which inserts into class_index_ and active_plugin_loaders_ meanwhile
+      ClassIndex & index = getClassIndexForBaseClass(typeid(Base).name());
+      auto itr = index.classes.find(class_name);
+      if (itr != index.classes.end()) {
+        return itr->second;
+      }
+
+      // Answered loaders are indexed right away, the cheapest other one is loaded with loader_mutex_ released
+      PluginLoader * next = nullptr;
+      ProbeCost next_cost = UNLOADED;
+      for (auto & it : active_plugin_loaders_) {
+        PluginLoader * loader = it.second;
+        if (std::find(index.indexed_loaders.begin(), index.indexed_loaders.end(), loader) !=
+          index.indexed_loaders.end())
+        {
+          continue;
+        }
+        ProbeCost cost = ANSWERED;
+        if (!loader->hasManifest()) {
+          if (loader->isLoadPending()) {
+            cost = PENDING;
+          } else if (!loader->holdsLoadReference()) {
+            // Also when another loader has the library open: this one lists its classes only once it loaded it
+            cost = UNLOADED;
+          }
+        }
+        if (cost != ANSWERED) {
+          if (nullptr == next || cost < next_cost) {
+            next = loader;
+            next_cost = cost;
+          }
+          continue;
+        }
+        loader->forEachAvailableClass<Base>([&index, loader](std::string_view name) {
+          PluginLoader *& owner = index.classes[name];
+          if (nullptr == owner) {
+            owner = loader;
+          }
+        });
+        index.indexed_loaders.push_back(loader);
+
+        itr = index.classes.find(class_name);
+        if (itr != index.classes.end()) {
+          return itr->second;
+        }
+      }
+
+      if (!index_asked && plugin_index_ != nullptr) {
+        index_asked = true;
+        const std::string library_path = plugin_index_->findLibraryForClass<Base>(class_name);
+        if (!library_path.empty()) {
+          lock.unlock();
+          loadLibrary(library_path);
+          return getPluginLoaderForLibrary(library_path);
+        }
+      }
+      if (nullptr == next) {
+        return nullptr;
       }
-      if ((*i)->isClassAvailable<Base>(class_name)) {
-        return *i;
+      lock.unlock();
+      if (PENDING == next_cost) {
+        next->waitForPendingLoads();
+      } else {
+        next->loadLibrary();
       }
+      lock.lock();
     }
-    return nullptr;
   }
 
+  /**
+   * @brief Classes known for one base class, and the loaders whose classes have been added
+   */
+  struct ClassIndex
+  {
+    impl::FlatHashMap<PluginLoader *> classes;
+    PluginLoaderVector indexed_loaders;
+  };
+
+  /**
+   * @brief Gets the class index for a base class, created empty on first use. loader_mutex_ must be held.
+   * @param typeid_base_class_name - typeid(Base).name()
+   */
+  ClassIndex & getClassIndexForBaseClass(const std::string & typeid_base_class_name);
+
+  /**
+   * @brief Drops every class index entry pointing at a loader that is about to be destroyed. loader_mutex_ must be held.
+   */
+  void removePluginLoaderFromClassIndex(PluginLoader * loader);
+
   /**
    * @brief Gets all class loaders loaded within scope
    */
@@ -351,10 +590,58 @@ private:
    */
   void shutdownAllPluginLoaders();
 
+  /**
+   * @brief Workers loading the libraries queued by loadPlan()
+   */
+  class BackgroundLoads;
+
+  /**
+   * @brief A build of a library loaded by reloadLibrary(), from a copy unless it is the first one
+   */
+  struct Generation
+  {
+    PluginLoader * loader;
+    unsigned number;
+    std::string image_path;  // The file the loader opened
+  };
+
+  /**
+   * @brief Destroys the superseded generations whose last instance died, and removes their copy
+   */
+  void collectRetiredGenerations();
+
+  typedef std::vector<std::pair<LibraryPath, Generation>> GenerationVector;
+
+  /**
+   * @brief Takes the superseded generations whose last instance died out of retired_generations_.
+   * generation_mutex_ must be held. @see destroyGenerations()
+   */
+  GenerationVector takeFinishedGenerations();
+
+  /**
+   * @brief Destroys the loaders of generations taken out of the bookkeeping, and removes their copy. Called with
+   * generation_mutex_ released.
+   */
+  void destroyGenerations(const GenerationVector & generations);
+
+  /**
+   * @brief Removes the file a generation was loaded from, if it is a copy
+   */
+  void removeGenerationImage(const LibraryPath & library_path, const Generation & generation);
+
 private:
   bool enable_ondemand_loadunload_;
-  LibraryToPluginLoaderMap active_plugin_loaders_;
+  bool use_manifests_;
+  LibraryToPluginLoaderMap active_plugin_loaders_;  // Guarded by loader_mutex_, like the class index
+  impl::FlatHashMap<ClassIndex> class_index_;
   std::mutex loader_mutex_;
+  std::unique_ptr<BackgroundLoads> background_loads_;  // Created under loader_mutex_, then kept until destruction
+  const PluginIndex * plugin_index_;
+  // Serializes unloadLibrary() and reloadLibrary(), which destroy and replace loaders, and guards the generations.
+  // Taken before loader_mutex_.
+  std::mutex generation_mutex_;
+  std::map<LibraryPath, Generation> generations_;  // Current generation of the reloaded libraries
+  GenerationVector retired_generations_;
 };
 
 } // namespace plugin
@@ -0,0 +1,353 @@
+#include "PluginIndex.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <system_error>
+
+#include "Console.h"
+#include "Exceptions.hpp"
+
+#if defined(__linux__)
+#include <errno.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace plugin
+{
+
+namespace
+{
+
+const char * const INDEX_HEADER = "plugin_loader_index";
+const unsigned INDEX_VERSION = 1;
+
+/**
+ * What tells whether a library changed since it was indexed
+ */
+struct FileIdentity
+{
+  std::uint64_t inode;
+  std::uint64_t size;
+  std::int64_t mtime;
+};
+
+bool getFileIdentity(const std::string & path, FileIdentity & identity)
+{
+#if defined(__linux__)
+  struct stat status;
+  if (::stat(path.c_str(), &status) != 0 || !S_ISREG(status.st_mode)) {
+    return false;
+  }
+  identity.inode = static_cast<std::uint64_t>(status.st_ino);
+  identity.size = static_cast<std::uint64_t>(status.st_size);
+  identity.mtime = static_cast<std::int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+  return true;
+#else
+  std::error_code error;
+  if (!std::filesystem::is_regular_file(path, error)) {
+    return false;
+  }
+  const std::uintmax_t size = std::filesystem::file_size(path, error);
+  const std::filesystem::file_time_type mtime = std::filesystem::last_write_time(path, error);
+  if (error) {
+    return false;
+  }
+  identity.inode = 0;
+  identity.size = static_cast<std::uint64_t>(size);
+  identity.mtime = static_cast<std::int64_t>(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count());
+  return true;
+#endif
+}
+
+std::vector<PluginManifest::Entry> readClasses(const std::string & library_path)
+{
+  PluginManifest manifest;
+  if (manifest.readEmbedded(library_path)) {
+    return manifest.getClasses();
+  }
+  try {
+    if (manifest.read(PluginManifest::getManifestPath(library_path)) &&
+      manifest.getLibraryHash() == PluginManifest::hashFile(library_path))
+    {
+      return manifest.getClasses();
+    }
+    return PluginManifest::generate(library_path).getClasses();
+  }
+  catch (const std::exception & e) {
+    logWarn("plugin::PluginIndex: Could not index library %s: %s", library_path.c_str(), e.what());
+    return std::vector<PluginManifest::Entry>();
+  }
+}
+
+} // namespace
+
+PluginIndex::PluginIndex(const std::string & directory, const std::string & pattern)
+: directory_(directory), pattern_(pattern), watch_fd_(-1)
+{
+}
+
+PluginIndex::~PluginIndex()
+{
+#if defined(__linux__)
+  if (watch_fd_ >= 0) {
+    ::close(watch_fd_);
+  }
+#endif
+}
+
+bool PluginIndex::matchesPattern(std::string_view name, std::string_view pattern)
+{
+  std::size_t n = 0, p = 0;
+  std::size_t star = std::string_view::npos, star_n = 0;
+  while (n < name.size()) {
+    if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+      ++n;
+      ++p;
+    } else if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      star_n = n;
+    } else if (star != std::string_view::npos) {
+      p = star + 1;
+      n = ++star_n;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*') {
+    ++p;
+  }
+  return p == pattern.size();
+}
+
+bool PluginIndex::read(const std::string & index_path)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  entries_.clear();
+
+  std::ifstream file(index_path);
+  std::string header;
+  unsigned version = 0;
+  if (!(file >> header >> version) || header != INDEX_HEADER || version != INDEX_VERSION) {
+    return false;
+  }
+
+  std::string line;
+  std::getline(file, line);
+  Entry * entry = nullptr;
+  while (std::getline(file, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    std::istringstream fields(line);
+    std::string key;
+    bool valid = static_cast<bool>(std::getline(fields, key, '\t'));
+    if (valid && key == "library") {
+      Entry library;
+      std::string inode, size, mtime;
+      valid = std::getline(fields, inode, '\t') && std::getline(fields, size, '\t') &&
+        std::getline(fields, mtime, '\t') && std::getline(fields, library.library_path) &&
+        !library.library_path.empty();
+      try {
+        if (valid) {
+          library.inode = std::stoull(inode);
+          library.size = std::stoull(size);
+          library.mtime = std::stoll(mtime);
+          entry = &(entries_[library.library_path] = library);
+        }
+      }
+      catch (const std::exception &) {
+        valid = false;
+      }
+    } else if (valid && key == "class" && entry != nullptr) {
+      PluginManifest::Entry class_entry;
+      valid = std::getline(fields, class_entry.typeid_base_class_name, '\t') &&
+        std::getline(fields, class_entry.base_class_name, '\t') && std::getline(fields, class_entry.class_name);
+      if (valid) {
+        entry->classes.push_back(class_entry);
+      }
+    } else {
+      valid = false;
+    }
+    if (!valid) {
+      entries_.clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+void PluginIndex::write(const std::string & index_path) const
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::ofstream file(index_path, std::ios::trunc);
+  file << INDEX_HEADER << ' ' << INDEX_VERSION << '\n';
+  for (auto & it : entries_) {
+    const Entry & entry = it.second;
+    file << "library\t" << entry.inode << '\t' << entry.size << '\t' << entry.mtime << '\t' <<
+      entry.library_path << '\n';
+    for (const PluginManifest::Entry & class_entry : entry.classes) {
+      file << "class\t" << class_entry.typeid_base_class_name << '\t' << class_entry.base_class_name << '\t' <<
+        class_entry.class_name << '\n';
+    }
+  }
+  file.close();
+  if (!file) {
+    throw plugin::PluginLoaderException("Could not write plugin index " + index_path);
+  }
+}
+
+std::size_t PluginIndex::update()
+{
+  std::set<std::string> library_paths;
+  std::error_code error;
+  for (std::filesystem::directory_iterator itr(directory_, error), end; !error && itr != end; itr.increment(error)) {
+    const std::string file_name = itr->path().filename().string();
+    if (matchesPattern(file_name, pattern_)) {
+      library_paths.insert((std::filesystem::path(directory_) / file_name).string());
+    }
+  }
+  if (error) {
+    throw plugin::LibraryLoadException("Could not read plugin directory " + directory_ + ": " + error.message());
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::size_t changes = 0;
+  for (auto itr = entries_.begin(); itr != entries_.end(); ) {
+    if (library_paths.count(itr->first) == 0) {
+      itr = entries_.erase(itr);
+      ++changes;
+    } else {
+      ++itr;
+    }
+  }
+  for (const std::string & library_path : library_paths) {
+    if (refresh(library_path)) {
+      ++changes;
+    }
+  }
+  return changes;
+}
+
+bool PluginIndex::refresh(const std::string & library_path)
+{
+  FileIdentity identity;
+  auto itr = entries_.find(library_path);
+  if (!getFileIdentity(library_path, identity)) {
+    if (itr == entries_.end()) {
+      return false;
+    }
+    entries_.erase(itr);
+    return true;
+  }
+  if (itr != entries_.end() && itr->second.inode == identity.inode && itr->second.size == identity.size &&
+    itr->second.mtime == identity.mtime)
+  {
+    return false;
+  }
+  entries_[library_path] =
+    Entry{library_path, identity.inode, identity.size, identity.mtime, readClasses(library_path)};
+  return true;
+}
+
+bool PluginIndex::startWatching()
+{
+#if defined(__linux__)
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (watch_fd_ >= 0) {
+    return true;
+  }
+  const int fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  // Libraries are installed by writing them or moving them in; IN_CREATE would see them half written
+  if (::inotify_add_watch(fd, directory_.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0) {
+    ::close(fd);
+    return false;
+  }
+  watch_fd_ = fd;
+  return true;
+#else
+  return false;
+#endif
+}
+
+std::size_t PluginIndex::processEvents()
+{
+#if defined(__linux__)
+  std::set<std::string> library_paths;
+  bool overflow = false;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (watch_fd_ < 0) {
+      return 0;
+    }
+    alignas(struct inotify_event) char buffer[4096];
+    while (true) {
+      const ssize_t length = ::read(watch_fd_, buffer, sizeof(buffer));
+      if (length <= 0) {
+        if (length < 0 && EINTR == errno) {
+          continue;
+        }
+        break;
+      }
+      for (ssize_t offset = 0; offset < length; ) {
+        const struct inotify_event * event = reinterpret_cast<const struct inotify_event *>(buffer + offset);
+        if (event->mask & IN_Q_OVERFLOW) {
+          overflow = true;
+        } else if (event->len > 0 && matchesPattern(event->name, pattern_)) {
+          library_paths.insert((std::filesystem::path(directory_) / event->name).string());
+        }
+        offset += sizeof(struct inotify_event) + event->len;
+      }
+    }
+  }
+  if (overflow) {
+    return update();
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::size_t changes = 0;
+  for (const std::string & library_path : library_paths) {
+    if (refresh(library_path)) {
+      ++changes;
+    }
+  }
+  return changes;
+#else
+  return 0;
+#endif
+}
+
+std::string PluginIndex::findLibraryForClass(
+  std::string_view typeid_base_class_name, std::string_view class_name) const
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (auto & it : entries_) {
+    for (const PluginManifest::Entry & entry : it.second.classes) {
+      if (entry.class_name == class_name && entry.typeid_base_class_name == typeid_base_class_name) {
+        return it.first;
+      }
+    }
+  }
+  return std::string();
+}
+
+std::vector<PluginIndex::Entry> PluginIndex::getEntries() const
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::vector<Entry> entries;
+  entries.reserve(entries_.size());
+  for (auto & it : entries_) {
+    entries.push_back(it.second);
+  }
+  return entries;
+}
+
+} // namespace plugin
@@ -0,0 +1,149 @@
+#ifndef PLUGIN_PLUGIN_INDEX_HPP_
+#define PLUGIN_PLUGIN_INDEX_HPP_
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <typeinfo>
+#include <vector>
+
+#include "PluginManifest.hpp"
+#include "SharedLibrary.hpp"
+#include "VisibilityControl.h"
+
+namespace plugin {
+
+/**
+ * @class PluginIndex
+ * @brief Classes of every plugin library of a directory, kept up to date incrementally and saved between runs.
+ *
+ * Each library is recorded with its inode, size and modification time: update() only reads the libraries whose
+ * identity changed since they were indexed, so a process that reads the index back at start touches no unchanged
+ * file. The classes of a library come from its embedded records (@see PluginManifest::readEmbedded()), else from its
+ * manifest if the hash matches, else by loading it once (@see PluginManifest::generate()).
+ *
+ * On Linux the directory can also be watched with inotify (@see startWatching()): processEvents() then updates only
+ * the libraries that were written, moved or deleted, without scanning the directory.
+ *
+ * The file is text: a "plugin_loader_index <version>" line, then per library a
+ * "library <inode> <size> <mtime in ns> <path>" line followed by its
+ * "class <typeid(Base).name()> <base class name> <class name>" lines, fields separated by tabs.
+ *
+ * All member functions are thread safe.
+ */
+class PluginIndex
+{
+public:
+  struct Entry
+  {
+    std::string library_path;
+    std::uint64_t inode;
+    std::uint64_t size;
+    std::int64_t mtime;  // Nanoseconds
+    std::vector<PluginManifest::Entry> classes;
+  };
+
+  /**
+   * @brief Builds an empty index of a directory, filled by read() or update()
+   * @param directory - the directory, not recursed into
+   * @param pattern - file name pattern of the libraries, @see matchesPattern()
+   */
+  PLUGIN_LOADER_PUBLIC
+  explicit PluginIndex(const std::string & directory, const std::string & pattern = "*" + SharedLibrary::suffix());
+
+  PLUGIN_LOADER_PUBLIC
+  ~PluginIndex();
+
+  PluginIndex(const PluginIndex &) = delete;
+  PluginIndex & operator=(const PluginIndex &) = delete;
+
+  const std::string & getDirectory() const {return directory_;}
+
+  /**
+   * @brief Matches a whole file name against a pattern where '*' matches any run of characters and '?' any one
+   * character
+   */
+  PLUGIN_LOADER_PUBLIC
+  static bool matchesPattern(std::string_view name, std::string_view pattern);
+
+  /**
+   * @brief Replaces the content of this index with the one of a file. Call update() afterwards to catch up with
+   * the changes made since it was written.
+   * @return false if the file is missing or malformed, in which case this index is left empty
+   */
+  PLUGIN_LOADER_PUBLIC
+  bool read(const std::string & index_path);
+
+  /**
+   * @brief Writes this index to a file
+   * @throws PluginLoaderException if it cannot be written
+   */
+  PLUGIN_LOADER_PUBLIC
+  void write(const std::string & index_path) const;
+
+  /**
+   * @brief Scans the directory: indexes new and changed libraries and drops the vanished ones
+   * @return The number of libraries added, changed or dropped
+   * @throws LibraryLoadException if the directory cannot be read
+   */
+  PLUGIN_LOADER_PUBLIC
+  std::size_t update();
+
+  /**
+   * @brief Starts watching the directory for libraries being written, moved or deleted
+   * @return false if it cannot be watched, e.g. on platforms other than Linux
+   */
+  PLUGIN_LOADER_PUBLIC
+  bool startWatching();
+
+  /**
+   * @brief Gets the descriptor to wait on for processEvents() to have work, e.g. with poll(), -1 if not watching
+   */
+  int getWatchDescriptor() const {return watch_fd_;}
+
+  /**
+   * @brief Updates the libraries the watch reported since the last call, without waiting for more. Falls back to a
+   * full update() when the kernel dropped events.
+   * @return The number of libraries added, changed or dropped
+   */
+  PLUGIN_LOADER_PUBLIC
+  std::size_t processEvents();
+
+  /**
+   * @brief Gets the library providing a class, empty if none does. If several do, the first by path.
+   * @param typeid_base_class_name - typeid(Base).name()
+   */
+  PLUGIN_LOADER_PUBLIC
+  std::string findLibraryForClass(std::string_view typeid_base_class_name, std::string_view class_name) const;
+
+  template<class Base>
+  std::string findLibraryForClass(std::string_view class_name) const
+  {
+    return findLibraryForClass(typeid(Base).name(), class_name);
+  }
+
+  /**
+   * @brief Gets a copy of the entries, sorted by path
+   */
+  PLUGIN_LOADER_PUBLIC
+  std::vector<Entry> getEntries() const;
+
+private:
+  /**
+   * @brief Brings the entry of one library up to date. mutex_ must be held.
+   * @return true if it was added, changed or dropped
+   */
+  bool refresh(const std::string & library_path);
+
+  std::string directory_;
+  std::string pattern_;
+  std::map<std::string, Entry> entries_;  // By path, under mutex_
+  mutable std::mutex mutex_;
+  int watch_fd_;
+};
+
+} // namespace plugin
+
+#endif // PLUGIN_PLUGIN_INDEX_HPP_
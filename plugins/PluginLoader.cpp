@@ -27,32 +27,96 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
 #include "PluginLoader.hpp"
 #include "PluginLoaderCore.hpp"
 
 namespace plugin 
 {
 
-bool PluginLoader::has_unmananged_instance_been_created_ = false;
+std::atomic<bool> PluginLoader::has_unmananged_instance_been_created_(false);
 
 bool PluginLoader::hasUnmanagedInstanceBeenCreated()
 {
-	return PluginLoader::has_unmananged_instance_been_created_;
+	return PluginLoader::has_unmananged_instance_been_created_.load(std::memory_order_relaxed);
 }
 
-PluginLoader::PluginLoader(const std::string & library_path, bool ondemand_load_unload)
+/**
+ * A load of loadLibraryAsync(), run once by whichever thread claims it first
+ */
+struct PluginLoader::PendingLoad
+{
+	std::function<void()> load;
+	std::promise<void> promise;
+	std::shared_future<void> done;
+	std::atomic<bool> claimed;
+
+	explicit PendingLoad(std::function<void()> load)
+		: load(std::move(load)), done(promise.get_future().share()), claimed(false)
+	{
+	}
+
+	// Runs the load unless another thread got to it first, then waits for it
+	void runOrWait()
+	{
+		if (!claimed.exchange(true)) {
+			try {
+				load();
+				promise.set_value();
+			}
+			catch (...) {
+				promise.set_exception(std::current_exception());
+			}
+		}
+		done.wait();
+	}
+
+	// Drops the load unless another thread got to it first, then waits for it
+	void cancelOrWait(const std::string & library_path)
+	{
+		if (!claimed.exchange(true)) {
+			promise.set_exception(std::make_exception_ptr(plugin::LibraryLoadException(
+				"Load of library " + library_path + " cancelled, its PluginLoader was destroyed")));
+		}
+		done.wait();
+	}
+};
+
+PluginLoader::PluginLoader(
+	const std::string & library_path, bool ondemand_load_unload,
+	const SharedLibrary::LoadOptions & load_options)
+	: PluginLoader(DeferLoad(), library_path, ondemand_load_unload, load_options)
+{
+	if (!isOnDemandLoadUnloadEnabled()) {
+		loadLibrary();
+	}
+}
+
+PluginLoader::PluginLoader(
+	DeferLoad, const std::string & library_path, bool ondemand_load_unload,
+	const SharedLibrary::LoadOptions & load_options)
 	: ondemand_load_unload_(ondemand_load_unload),
 	library_path_(library_path),
+	load_options_(load_options),
 	load_ref_count_(0),
-	plugin_ref_count_(0)
+	plugin_ref_count_(0),
+	manifest_verified_(false),
+	manifest_rejected_(false),
+	load_pending_(false),
+	retired_(false)
 {
 	logDebug(
 		"plugin_loader.PluginLoader: "
 		"Constructing new PluginLoader (%p) bound to library %s.",
 		this, library_path.c_str());
-	if (!isOnDemandLoadUnloadEnabled()) {
-		loadLibrary();
-	}
 }
 
 PluginLoader::~PluginLoader()
@@ -60,6 +124,15 @@ PluginLoader::~PluginLoader()
 	logDebug("%s",
 		"plugin_loader.PluginLoader: "
 		"Destroying class loader, unloading associated library...\n");
+	// The background loads use this loader: they must be over, or never start, before it goes away
+	std::vector<std::shared_ptr<PendingLoad>> pending_loads;
+	{
+		std::unique_lock<std::mutex> lock(pending_loads_mutex_);
+		pending_loads.swap(pending_loads_);
+	}
+	for (auto & pending_load : pending_loads) {
+		pending_load->cancelOrWait(getLibraryPath());
+	}
 	unloadLibrary();  // TODO(mikaelarguedas): while(unloadLibrary() > 0){} ??
 }
 
@@ -76,8 +149,95 @@ bool PluginLoader::isLibraryLoadedByAnyClassloader()
 void PluginLoader::loadLibrary()
 {
 	std::unique_lock<std::recursive_mutex> lock(load_ref_count_mutex_);
-	load_ref_count_ = load_ref_count_ + 1;
-	plugin::impl::loadLibrary(getLibraryPath(), this);
+	plugin::impl::loadLibrary(getLibraryPath(), this, load_options_);
+	verifyManifest();
+	// Counted only once loaded: prepareCreate() trusts a non-zero count without asking the registry
+	load_ref_count_.fetch_add(1, std::memory_order_release);
+}
+
+std::shared_future<void> PluginLoader::loadLibraryAsync()
+{
+	return loadLibraryAsync([](std::function<void()> job) {
+			std::thread(std::move(job)).detach();
+		});
+}
+
+std::shared_future<void> PluginLoader::loadLibraryAsync(const LoadExecutor & executor)
+{
+	std::shared_ptr<PendingLoad> pending_load = std::make_shared<PendingLoad>([this]() {
+			SharedLibrary::prefetch(getLibraryPath());
+			loadLibrary();
+		});
+	{
+		std::unique_lock<std::mutex> lock(pending_loads_mutex_);
+		pending_loads_.push_back(pending_load);
+		load_pending_.store(true, std::memory_order_release);
+	}
+	// The job only holds the PendingLoad: if this loader is gone by the time it runs, it was cancelled
+	executor([pending_load]() {pending_load->runOrWait();});
+	return pending_load->done;
+}
+
+void PluginLoader::waitForPendingLoads()
+{
+	std::vector<std::shared_ptr<PendingLoad>> pending_loads;
+	{
+		std::unique_lock<std::mutex> lock(pending_loads_mutex_);
+		pending_loads = pending_loads_;
+	}
+	for (auto & pending_load : pending_loads) {
+		pending_load->runOrWait();
+	}
+	forgetFinishedLoads();
+}
+
+void PluginLoader::forgetFinishedLoads()
+{
+	std::unique_lock<std::mutex> lock(pending_loads_mutex_);
+	pending_loads_.erase(
+		std::remove_if(pending_loads_.begin(), pending_loads_.end(), [](const std::shared_ptr<PendingLoad> & load) {
+			return load->done.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+		}),
+		pending_loads_.end());
+	load_pending_.store(!pending_loads_.empty(), std::memory_order_release);
+}
+
+bool PluginLoader::loadManifest()
+{
+	std::unique_lock<std::recursive_mutex> lock(load_ref_count_mutex_);
+	std::unique_ptr<PluginManifest> manifest(new PluginManifest());
+	if (!manifest->read(PluginManifest::getManifestPath(getLibraryPath())) &&
+		!manifest->readEmbedded(getLibraryPath()))
+	{
+		logDebug(
+			"plugin::PluginLoader: No usable manifest for library %s, classes are listed once it is loaded.",
+			getLibraryPath().c_str());
+		return false;
+	}
+	manifest_ = std::move(manifest);
+	manifest_verified_ = false;
+	manifest_rejected_.store(false, std::memory_order_release);
+	if (load_ref_count_.load(std::memory_order_acquire) > 0) {
+		verifyManifest();
+	}
+	return true;
+}
+
+void PluginLoader::verifyManifest()
+{
+	if (!hasManifest() || manifest_verified_) {
+		return;
+	}
+	if (manifest_->verify(getLibraryPath())) {
+		manifest_verified_ = true;
+		return;
+	}
+	logWarn(
+		"plugin::PluginLoader: "
+		"The manifest of library %s does not match the library (stale build?). It is ignored and classes are "
+		"listed from the library itself.",
+		getLibraryPath().c_str());
+	manifest_rejected_.store(true, std::memory_order_release);
 }
 
 int PluginLoader::unloadLibrary()
@@ -85,6 +245,50 @@ int PluginLoader::unloadLibrary()
 	return unloadLibraryInternal(true);
 }
 
+void PluginLoader::releasePluginReference()
+{
+	int previous = plugin_ref_count_.fetch_sub(1, std::memory_order_acq_rel);
+	assert(previous > 0);
+	(void)previous;
+	const bool retired = retired_.load(std::memory_order_acquire);
+	if (1 != previous || !(isOnDemandLoadUnloadEnabled() || retired)) {
+		return;
+	}
+
+	// Last reference: only now lock, and give up if another thread created an instance meanwhile
+	std::unique_lock<std::recursive_mutex> lock(plugin_ref_count_mutex_);
+	if (0 == plugin_ref_count_.load(std::memory_order_acquire)) {
+		if (!PluginLoader::hasUnmanagedInstanceBeenCreated()) {
+			// A retired loader gives up all its load references, not only the one of on-demand mode
+			int remaining = unloadLibraryInternal(false);
+			while (retired && remaining > 0 && 0 == plugin_ref_count_.load(std::memory_order_acquire)) {
+				remaining = unloadLibraryInternal(false);
+			}
+		} else {
+			logWarn(
+				"plugin::PluginLoader: "
+				"Cannot unload library %s even though last shared pointer went out of scope. "
+				"This is because createUnmanagedInstance was used within the scope of this process,"
+				" perhaps by a different PluginLoader. Library will NOT be closed.",
+				getLibraryPath().c_str());
+		}
+	}
+}
+
+void PluginLoader::retire()
+{
+	retired_.store(true, std::memory_order_release);
+	// Either this or the release of the last instance sees both the flag and no instance
+	std::unique_lock<std::recursive_mutex> lock(plugin_ref_count_mutex_);
+	if (PluginLoader::hasUnmanagedInstanceBeenCreated()) {
+		return;
+	}
+	int remaining = load_ref_count_.load(std::memory_order_acquire);
+	while (remaining > 0 && 0 == plugin_ref_count_.load(std::memory_order_acquire)) {
+		remaining = unloadLibraryInternal(false);
+	}
+}
+
 int PluginLoader::unloadLibraryInternal(bool lock_plugin_ref_count)
 {
 	std::unique_lock<std::recursive_mutex> load_ref_lock(load_ref_count_mutex_);
@@ -93,7 +297,7 @@ int PluginLoader::unloadLibraryInternal(bool lock_plugin_ref_count)
 		plugin_ref_lock = std::unique_lock<std::recursive_mutex>(plugin_ref_count_mutex_);
 	}
 
-	if (plugin_ref_count_ > 0) {
+	if (plugin_ref_count_.load(std::memory_order_acquire) > 0) {
 		logWarn("%s",
 			"plugin_loader.PluginLoader: "
 			"SEVERE WARNING!!! Attempting to unload library while objects created by this loader "
@@ -101,16 +305,19 @@ int PluginLoader::unloadLibraryInternal(bool lock_plugin_ref_count)
 			"You should delete your objects before attempting to unload the library or "
 			"destroying the PluginLoader. The library will NOT be unloaded.");
 	}
-	else {
-		load_ref_count_ = load_ref_count_ - 1;
-		if (0 == load_ref_count_) {
-			plugin::impl::unloadLibrary(getLibraryPath(), this);
-		}
-		else if (load_ref_count_ < 0) {
-			load_ref_count_ = 0;
+	else if (load_ref_count_.load(std::memory_order_relaxed) > 0) {
+		// Dropped before unloading, so prepareCreate() no longer takes the library for loaded. A creation takes its
+		// plugin reference before it reads this count: either it sees the count dropped and loads again under
+		// load_ref_count_mutex_, or its reference is seen here and the library stays.
+		if (1 == load_ref_count_.fetch_sub(1)) {
+			if (plugin_ref_count_.load() > 0) {
+				load_ref_count_.fetch_add(1);
+			} else {
+				plugin::impl::unloadLibrary(getLibraryPath(), this);
+			}
 		}
 	}
-	return load_ref_count_;
+	return load_ref_count_.load(std::memory_order_relaxed);
 }
 
 } // namespace plugin
\ No newline at end of file
@@ -34,20 +34,66 @@
 
 #include <functional>
 #include <memory>
+#include <memory_resource>
 #include <mutex>
 #include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <exception>
+#include <future>
+#include <thread>
+#include <type_traits>
+#include <typeinfo>
 #include <assert.h>
 
 #include "PluginLoaderCore.hpp"
 #include "PluginMacro.hpp"
+#include "PluginManifest.hpp"
+#include "UsageProfile.hpp"
 #include "VisibilityControl.h"
 
 
 namespace plugin {
 
+template<class Base>
+class FactoryHandle;
+
+template<class Base>
+class InstancePool;
+
+class PluginLoader;
+class MultiLibraryPluginLoader;
+
+/**
+ * @class PluginDeleter
+ * @brief Deleter of managed plugin instances: hands the object back to the PluginLoader that created it.
+ *
+ * A single pointer, so PluginLoader::UniquePtr<Base> is two pointers wide and destroying it is a direct call
+ * instead of going through std::function. A default-constructed deleter plainly deletes the object.
+ */
+template<class Base>
+class PluginDeleter
+{
+public:
+  PluginDeleter() : loader_(nullptr) {}
+  explicit PluginDeleter(PluginLoader * loader) : loader_(loader) {}
+
+  void operator()(Base * obj) const;
+
+  /**
+   * @brief Gets the PluginLoader the object is returned to
+   */
+  PluginLoader * getPluginLoader() const {return loader_;}
+
+private:
+  PluginLoader * loader_;
+};
+
 /**
  * @class PluginLoader
  * @brief This class allows loading and unloading of dynamically linked libraries which contain class definitions from which objects can be created/destroyed during runtime (i.e. plugin). Libraries loaded by a PluginLoader are only accessible within scope of that PluginLoader object.
@@ -56,7 +102,7 @@ class PluginLoader
 {
 public:
   template<typename Base>
-  using DeleterType = std::function<void(Base *)>;
+  using DeleterType = PluginDeleter<Base>;
 
   template<typename Base>
   using UniquePtr = std::unique_ptr<Base, DeleterType<Base>>;
@@ -65,9 +111,12 @@ public:
    * @brief  Constructor for PluginLoader
    * @param library_path - The path of the runtime library to load
    * @param ondemand_load_unload - Indicates if on-demand (lazy) unloading/loading of libraries occurs as plugins are created/destroyed
+   * @param load_options - Binding (lazy/now) and symbol scope (global/local) used whenever this loader opens the library
    */
   PLUGIN_LOADER_PUBLIC
-  explicit PluginLoader(const std::string & library_path, bool ondemand_load_unload = false);
+  explicit PluginLoader(
+    const std::string & library_path, bool ondemand_load_unload = false,
+    const SharedLibrary::LoadOptions & load_options = SharedLibrary::LoadOptions());
 
   /**
    * @brief  Destructor for PluginLoader. All libraries opened by this PluginLoader are unloaded automatically.
@@ -82,14 +131,58 @@ public:
   template<class Base>
   std::vector<std::string> getAvailableClasses()
   {
+    if (isAnsweredFromManifest()) {
+      std::vector<std::string> classes;
+      manifest_->forEachClass(typeid(Base).name(), [&classes](std::string_view class_name) {
+        classes.emplace_back(class_name);
+      });
+      return classes;
+    }
     return plugin::impl::getAvailableClasses<Base>(this);
   }
 
+  /**
+   * @brief  Visits the classes getAvailableClasses() would return without copying them
+   * @param  visit Callable taking a std::string_view, valid only during the call. It must not load or unload libraries.
+   */
+  template<class Base, class Visitor>
+  void forEachAvailableClass(Visitor && visit)
+  {
+    if (isAnsweredFromManifest()) {
+      manifest_->forEachClass(typeid(Base).name(), std::forward<Visitor>(visit));
+      return;
+    }
+    plugin::impl::forEachAvailableClass<Base>(this, std::forward<Visitor>(visit));
+  }
+
+  /**
+   * @brief  Reads the manifest generated next to the library at build time or, if there is none, the one embedded
+   * in the library by the registration macros (@see PluginManifest). Until this loader loads the library,
+   * getAvailableClasses(), forEachAvailableClass() and isClassAvailable() are answered from the manifest, so in
+   * on-demand mode nothing is opened before the first create. The manifest is verified against the library when it
+   * gets loaded and ignored from then on if they disagree.
+   * Call it before the loader is shared between threads.
+   * @return true if a manifest was read
+   */
+  PLUGIN_LOADER_PUBLIC
+  bool loadManifest();
+
+  /**
+   * @brief  Indicates if a manifest was read and has not been rejected by the verification on load
+   */
+  bool hasManifest() const {return manifest_ && !manifest_rejected_.load(std::memory_order_acquire);}
+
   /**
    * @brief Gets the full-qualified path and name of the library associated with this class loader
    */
   PLUGIN_LOADER_PUBLIC
-  std::string getLibraryPath() {return library_path_;}
+  const std::string & getLibraryPath() const {return library_path_;}
+
+  /**
+   * @brief Gets the options handed to the platform loader when this class loader opens its library
+   */
+  PLUGIN_LOADER_PUBLIC
+  const SharedLibrary::LoadOptions & getLoadOptions() const {return load_options_;}
 
   /**
    * @brief  Generates an instance of loadable classes (i.e. plugin).
@@ -97,15 +190,22 @@ public:
    * It is not necessary for the user to call loadLibrary() as it will be invoked automatically
    * if the library is not yet loaded (which typically happens when in "On Demand Load/Unload" mode).
    *
+   * The object is constructed inside the allocation of the shared_ptr control block, so a shared instance costs
+   * one allocation instead of two (classes larger than MAX_SHARED_INSTANCE_SIZE still take a second one).
+   *
    * @param  derived_class_name The name of the class we want to create (@see getAvailableClasses())
    * @return A std::shared_ptr<Base> to newly created plugin object
    */
   template<class Base>
   std::shared_ptr<Base> createSharedInstance(const std::string & derived_class_name)
   {
-    return std::shared_ptr<Base>(
-      createRawInstance<Base>(derived_class_name, true),
-      std::bind(&PluginLoader::onPluginDeletion<Base>, this, std::placeholders::_1));
+    std::shared_ptr<Base> instance;
+    createRawInstance<Base>(derived_class_name, true,
+      [this, &instance](const AbstractMetaObject<Base> & factory) {
+        instance = makeSharedInstance<Base>(factory);
+        return instance.get();
+      });
+    return instance;
   }
 
   /**
@@ -116,9 +216,75 @@ public:
   template<class Base>
   std::shared_ptr<Base> createInstance(const std::string & derived_class_name)
   {
-    return std::shared_ptr<Base>(
-      createRawInstance<Base>(derived_class_name, true),
-      std::bind(&PluginLoader::onPluginDeletion<Base>, this, std::placeholders::_1));
+    return createSharedInstance<Base>(derived_class_name);
+  }
+
+  /**
+   * @brief  Generates an instance of loadable classes (i.e. plugin) with all of its memory taken from resource.
+   *
+   * Object and shared_ptr control block are allocated from resource and returned to it when the last
+   * std::shared_ptr goes away, so e.g. a std::pmr::monotonic_buffer_resource can serve as a per-request arena.
+   * The resource must outlive every copy of the returned pointer.
+   *
+   * @param  derived_class_name The name of the class we want to create (@see getAvailableClasses())
+   * @param  resource The memory resource to allocate from
+   * @return A std::shared_ptr<Base> to newly created plugin object
+   */
+  template<class Base>
+  std::shared_ptr<Base> createInstance(
+    const std::string & derived_class_name, std::pmr::memory_resource * resource)
+  {
+    std::shared_ptr<Base> instance;
+    createRawInstance<Base>(derived_class_name, true,
+      [this, &instance, resource](const AbstractMetaObject<Base> & factory) {
+        instance = makeSharedInstance<Base>(factory, std::pmr::polymorphic_allocator<std::byte>(resource));
+        return instance.get();
+      });
+    return instance;
+  }
+
+  /**
+   * @brief  Generates count instances of one class at once.
+   *
+   * Same as calling createInstance() count times, except that loading the library, looking up the factory and
+   * updating the ref count happen once for the whole batch. With threads > 1 the objects are constructed in
+   * parallel, which pays off for classes with expensive constructors. If a constructor throws, the objects
+   * already built are destroyed and the exception is rethrown.
+   *
+   * @param  derived_class_name The name of the class we want to create (@see getAvailableClasses())
+   * @param  count The number of instances
+   * @param  threads The number of threads constructing objects, the calling one included
+   * @return The new objects
+   */
+  template<class Base>
+  std::vector<std::shared_ptr<Base>> createInstances(
+    const std::string & derived_class_name, std::size_t count, std::size_t threads = 1)
+  {
+    std::vector<std::shared_ptr<Base>> instances(count);
+    createInstanceBatch<Base>(count,
+      [&derived_class_name](std::size_t) -> const std::string & {return derived_class_name;},
+      [this, &instances](std::size_t i, const AbstractMetaObject<Base> & factory) {
+        instances[i] = makeSharedInstance<Base>(factory);
+      },
+      threads);
+    return instances;
+  }
+
+  /**
+   * @brief  Same as above with one instance of each class in derived_class_names, in the same order
+   */
+  template<class Base>
+  std::vector<std::shared_ptr<Base>> createInstances(
+    const std::vector<std::string> & derived_class_names, std::size_t threads = 1)
+  {
+    std::vector<std::shared_ptr<Base>> instances(derived_class_names.size());
+    createInstanceBatch<Base>(instances.size(),
+      [&derived_class_names](std::size_t i) -> const std::string & {return derived_class_names[i];},
+      [this, &instances](std::size_t i, const AbstractMetaObject<Base> & factory) {
+        instances[i] = makeSharedInstance<Base>(factory);
+      },
+      threads);
+    return instances;
   }
 
   /**
@@ -137,9 +303,7 @@ public:
   UniquePtr<Base> createUniqueInstance(const std::string & derived_class_name)
   {
     Base * raw = createRawInstance<Base>(derived_class_name, true);
-    return std::unique_ptr<Base, DeleterType<Base>>(
-      raw,
-      std::bind(&PluginLoader::onPluginDeletion<Base>, this, std::placeholders::_1));
+    return UniquePtr<Base>(raw, PluginDeleter<Base>(this));
   }
 
   /**
@@ -160,6 +324,82 @@ public:
     return createRawInstance<Base>(derived_class_name, false);
   }
 
+  /**
+   * @brief  Same as createSharedInstance() above, for classes registered with constructor arguments
+   * (@see PLUGIN_LOADER_REGISTER_CLASS_WITH_ARGS and PLUGIN_LOADER_REGISTER_FACTORY).
+   *
+   * The arguments must have exactly the registered types once decayed; there are no implicit conversions, so
+   * pass e.g. a std::string rather than a string literal. Anything else throws CreateClassException before
+   * any plugin code runs. Past that check the arguments are forwarded through a plain function pointer.
+   */
+  template<class Base, class Arg, class... Args>
+  std::shared_ptr<Base> createSharedInstance(
+    const std::string & derived_class_name, Arg && arg, Args &&... args)
+  {
+    std::shared_ptr<Base> instance;
+    createRawInstance<Base>(derived_class_name, true,
+      [&](const AbstractMetaObject<Base> & factory) {
+        typedef Base * (*Construct)(void *, typename std::decay<Arg>::type &&, typename std::decay<Args>::type &&...);
+        Construct construct = reinterpret_cast<Construct>(
+          getArgumentFactory<Base, Arg, Args...>(factory).construct);
+        instance = makeSharedInstance<Base, 16>(factory, std::allocator<void>(),
+          [&](void * storage) {
+            return construct(storage,
+              typename std::decay<Arg>::type(std::forward<Arg>(arg)),
+              typename std::decay<Args>::type(std::forward<Args>(args))...);
+          });
+        return instance.get();
+      });
+    return instance;
+  }
+
+  /**
+   * @brief  Same as createUniqueInstance() above, for classes registered with constructor arguments
+   * (@see createSharedInstance() with arguments)
+   */
+  template<class Base, class Arg, class... Args>
+  UniquePtr<Base> createUniqueInstance(
+    const std::string & derived_class_name, Arg && arg, Args &&... args)
+  {
+    Base * raw = createRawInstance<Base>(derived_class_name, true,
+      [&](const AbstractMetaObject<Base> & factory) {
+        return createWithArguments<Base>(factory, std::forward<Arg>(arg), std::forward<Args>(args)...);
+      });
+    return UniquePtr<Base>(raw, PluginDeleter<Base>(this));
+  }
+
+  /**
+   * @brief  Same as createUnmanagedInstance() above, for classes registered with constructor arguments
+   * (@see createSharedInstance() with arguments)
+   */
+  template<class Base, class Arg, class... Args>
+  Base * createUnmanagedInstance(
+    const std::string & derived_class_name, Arg && arg, Args &&... args)
+  {
+    return createRawInstance<Base>(derived_class_name, false,
+      [&](const AbstractMetaObject<Base> & factory) {
+        return createWithArguments<Base>(factory, std::forward<Arg>(arg), std::forward<Args>(args)...);
+      });
+  }
+
+  /**
+   * @brief  Resolves the factory of a plugin class once, for callers that create many instances of it.
+   *
+   * The handle keeps the resolved factory and re-resolves it only when the registry changed since, so
+   * FactoryHandle::create() skips the name lookup and ownership checks of createInstance(). Unknown classes
+   * are not an error until create() is called, which then throws like createInstance() does.
+   *
+   * @param  derived_class_name The name of the class we want to create (@see getAvailableClasses())
+   * @return A handle bound to this PluginLoader; it must not outlive it
+   */
+  template<class Base>
+  FactoryHandle<Base> getFactory(const std::string & derived_class_name)
+  {
+    FactoryHandle<Base> handle(this, derived_class_name);
+    handle.resolve();
+    return handle;
+  }
+
   /**
    * @brief Indicates if a plugin class is available
    * @param Base - polymorphic type indicating base class
@@ -167,11 +407,12 @@ public:
    * @return true if yes it is available, false otherwise
    */
   template<class Base>
-  bool isClassAvailable(const std::string & class_name)
+  bool isClassAvailable(std::string_view class_name)
   {
-    std::vector<std::string> available_classes = getAvailableClasses<Base>();
-    return std::find(
-      available_classes.begin(), available_classes.end(), class_name) != available_classes.end();
+    if (isAnsweredFromManifest()) {
+      return manifest_->hasClass(typeid(Base).name(), class_name);
+    }
+    return plugin::impl::isClassAvailable<Base>(class_name, this);
   }
 
   /**
@@ -202,6 +443,44 @@ public:
   PLUGIN_LOADER_PUBLIC
   void loadLibrary();
 
+  /**
+   * @brief  Runs a job on some thread, @see loadLibraryAsync(const LoadExecutor &)
+   */
+  typedef std::function<void(std::function<void()>)> LoadExecutor;
+
+  /**
+   * @brief  Same as loadLibrary(), on a background thread. The library and the libraries it needs that are not in
+   * the process yet are first prefetched all at once (@see SharedLibrary::prefetch()), so with a cold page cache the
+   * disk reads overlap instead of happening one file at a time inside the platform loader.
+   * Until the load completes, creating an instance through this loader waits for it; other loaders are not held up.
+   * Like loadLibrary(), each call takes one load reference, to be released with unloadLibrary().
+   * @return A future that becomes ready once the library is loaded, holding the LibraryLoadException on failure
+   */
+  PLUGIN_LOADER_PUBLIC
+  std::shared_future<void> loadLibraryAsync();
+
+  /**
+   * @brief  Same as loadLibraryAsync() but the load is handed to executor, e.g. a thread pool with an ordering of
+   * its own. A thread that needs the library before the executor got to the job (to create an instance, or in
+   * waitForPendingLoads()) runs the load itself and the job then does nothing. Loads nobody started yet are
+   * dropped when this loader is destroyed, their future holding a LibraryLoadException.
+   * @param executor - Called once with the job, which may run on any thread and at any time
+   */
+  PLUGIN_LOADER_PUBLIC
+  std::shared_future<void> loadLibraryAsync(const LoadExecutor & executor);
+
+  /**
+   * @brief  Indicates if a load started with loadLibraryAsync() may not be done yet
+   */
+  bool isLoadPending() const {return load_pending_.load(std::memory_order_acquire);}
+
+  /**
+   * @brief  Waits for the loads started with loadLibraryAsync() so far, whatever their outcome. Those that have
+   * not started yet are run on the calling thread.
+   */
+  PLUGIN_LOADER_PUBLIC
+  void waitForPendingLoads();
+
   /**
    * @brief  Attempts to unload a library loaded within scope of the PluginLoader. If the library is not opened, this method has no effect. If the library is opened by other another PluginLoader, the library will NOT be unloaded internally -- however this PluginLoader will no longer be able to instantiate plugin bound to that library. If there are plugin objects that exist in memory created by this classloader, a warning message will appear and the library will not be unloaded. If loadLibrary() was called multiple times (e.g. in the case of multiple threads or purposefully in a single thread), the user is responsible for calling unloadLibrary() the same number of times. The library will not be unloaded within the context of this classloader until the number of unload calls matches the number of loads.
    * @return The number of times more unloadLibrary() has to be called for it to be unbound from this PluginLoader
@@ -213,9 +492,10 @@ private:
   /**
    * @brief Callback method when a plugin created by this class loader is destroyed
    * @param obj - A pointer to the deleted object
+   * @param in_place - If true the object lives in storage owned by the caller: only its destructor is run
    */
   template<class Base>
-  void onPluginDeletion(Base * obj)
+  void onPluginDeletion(Base * obj, bool in_place = false)
   {
      logDebug(
        "plugin::PluginLoader: Calling onPluginDeletion() for obj ptr = %p.\n",
@@ -223,24 +503,39 @@ private:
     if (nullptr == obj) {
       return;
     }
-    std::unique_lock<std::recursive_mutex> lock(plugin_ref_count_mutex_);
-    delete (obj);
-    plugin_ref_count_ = plugin_ref_count_ - 1;
-    assert(plugin_ref_count_ >= 0);
-    if (0 == plugin_ref_count_ && isOnDemandLoadUnloadEnabled()) {
-      if (!PluginLoader::hasUnmanagedInstanceBeenCreated()) {
-        unloadLibraryInternal(false);
-      } else {
-        logWarn(
-          "plugin::PluginLoader: "
-          "Cannot unload library %s even though last shared pointer went out of scope. "
-          "This is because createUnmanagedInstance was used within the scope of this process,"
-          " perhaps by a different PluginLoader. Library will NOT be closed.",
-          getLibraryPath().c_str());
-      }
+    if (in_place) {
+      obj->~Base();
+    } else {
+      delete (obj);
     }
+    releasePluginReference();
   }
 
+  /**
+   * @brief Counts count more managed plugins (or other users of the library, e.g. an InstancePool) that keep the library loaded.
+   * Sequentially consistent, paired with the load count: @see unloadLibraryInternal()
+   */
+  void addPluginReference(int count = 1)
+  {
+    plugin_ref_count_.fetch_add(count);
+  }
+
+  /**
+   * @brief Drops the reference an unmanaged instance was created under. Never unloads: once an unmanaged instance
+   * exists, releasing the last reference does not unload anything anyway.
+   */
+  void dropCreationReference()
+  {
+    plugin_ref_count_.fetch_sub(1);
+  }
+
+  /**
+   * @brief Drops a reference taken by addPluginReference(), unloading the library on the last one in on-demand mode.
+   * Lock-free except on that last reference.
+   */
+  PLUGIN_LOADER_PUBLIC
+  void releasePluginReference();
+
   /**
    * @brief  Generates an instance of loadable classes (i.e. plugin).
    *
@@ -254,8 +549,105 @@ private:
   template<class Base>
   Base * createRawInstance(const std::string & derived_class_name, bool managed)
   {
+    return createRawInstance<Base>(derived_class_name, managed,
+      [](const AbstractMetaObject<Base> & factory) {return factory.create();});
+  }
+
+  /**
+   * @brief Same as above with the object materialized by construct, a callable taking the resolved const AbstractMetaObject<Base>&
+   */
+  template<class Base, class Construct>
+  Base * createRawInstance(const std::string & derived_class_name, bool managed, Construct && construct)
+  {
+    // Taken before the library is even looked at: while it is held the library cannot be unloaded underneath the
+    // factory. A managed instance keeps it, its deleter gives it back.
+    addPluginReference();
+    Base * obj = nullptr;
+    try {
+      obj = createReferencedInstance<Base>(derived_class_name, managed, construct);
+    } catch (...) {
+      releasePluginReference();
+      throw;
+    }
     if (!managed) {
-      has_unmananged_instance_been_created_ = true;
+      dropCreationReference();
+    }
+    return obj;
+  }
+
+  /**
+   * @brief Body of createRawInstance(), called with a plugin reference held
+   */
+  template<class Base, class Construct>
+  Base * createReferencedInstance(const std::string & derived_class_name, bool managed, Construct & construct)
+  {
+    prepareCreate(managed);
+
+    Base * obj = plugin::impl::createInstance<Base>(derived_class_name, this,
+      [&construct](const AbstractMetaObject<Base> & factory) {
+        Base * obj = construct(factory);
+        countCreations(factory, 1);
+        return obj;
+      });
+    assert(obj != nullptr);  // Unreachable assertion if createInstance() throws on failure
+    return obj;
+  }
+
+  /**
+   * @brief Same as above but through a FactoryHandle, falling back to the name lookup when the handle cannot be resolved (e.g. the library is not loaded yet)
+   */
+  template<class Base, class Construct>
+  Base * createRawInstance(FactoryHandle<Base> & handle, bool managed, Construct && construct)
+  {
+    auto counted_construct = [&construct](const AbstractMetaObject<Base> & factory) {
+        Base * obj = construct(factory);
+        countCreations(factory, 1);
+        return obj;
+      };
+    addPluginReference();
+    Base * obj = nullptr;
+    try {
+      // With the reference held, a load count seen non-zero stays so until the reference is dropped
+      if (load_ref_count_.load() > 0) {
+        obj = handle.tryCreate(counted_construct);
+      }
+      if (nullptr == obj) {
+        obj = createReferencedInstance<Base>(handle.getClassName(), managed, construct);
+      } else if (!managed) {
+        has_unmananged_instance_been_created_.store(true, std::memory_order_relaxed);
+      }
+    } catch (...) {
+      releasePluginReference();
+      throw;
+    }
+    if (!managed) {
+      dropCreationReference();
+    }
+    return obj;
+  }
+
+  /**
+   * @brief Counts objects created from a factory while usage is recorded, @see UsageProfile
+   */
+  static void countCreations(const AbstractMetaObjectBase & factory, std::uint64_t count)
+  {
+    if (UsageProfile::isRecording()) {
+      factory.countCreations(count);
+    }
+  }
+
+  /**
+   * @brief Common part of creating instances: records unmanaged creation and loads the library if needed
+   */
+  void prepareCreate(bool managed)
+  {
+    // Creating from a library that is still being loaded by loadLibraryAsync() waits for that load only
+    if (load_pending_.load(std::memory_order_acquire)) {
+      waitForPendingLoads();
+    }
+
+    if (!managed) {
+      has_unmananged_instance_been_created_.store(true, std::memory_order_relaxed);
     }
 
     if (
@@ -271,19 +663,280 @@ private:
         "final plugin destruction if on demand (lazy) loading/unloading mode is used."
       );
     }
-    if (!isLibraryLoaded()) {
-      loadLibrary();
+    // A non-zero load count means this loader holds the library, no need to ask the registry. A zero count is
+    // checked again under the lock, as an unload may be giving it back (@see unloadLibraryInternal()). Loaded even
+    // when another loader has the library open: the factories only serve the loaders that loaded it.
+    if (0 == load_ref_count_.load()) {
+      std::unique_lock<std::recursive_mutex> lock(load_ref_count_mutex_);
+      if (0 == load_ref_count_.load()) {
+        loadLibrary();
+      }
     }
+  }
 
-    Base * obj = plugin::impl::createInstance<Base>(derived_class_name, this);
-    assert(obj != nullptr);  // Unreachable assertion if createInstance() throws on failure
+  /**
+   * @brief Implements createInstances(): takes count references at once, resolves every factory up front and
+   * runs construct(i, factory) for i in [0, count), split over up to threads threads. The references keep the
+   * library loaded underneath the workers, which run outside of any registry read section.
+   * @param name_of - Callable returning the class name of instance i as a const std::string&
+   * @param construct - Callable building instance i; each instance must own one reference once built
+   */
+  template<class Base, class NameOf, class Construct>
+  void createInstanceBatch(std::size_t count, NameOf && name_of, Construct && construct, std::size_t threads)
+  {
+    if (0 == count) {
+      return;
+    }
+    // Taken up front, same as createRawInstance()
+    addPluginReference(static_cast<int>(count));
+
+    std::atomic<std::size_t> constructed(0);
+    std::exception_ptr error;
+    try {
+      prepareCreate(true);
+      std::vector<const AbstractMetaObject<Base> *> factories(count);
+      {
+        impl::FactoryMapSlot & slot = impl::getPublishedFactoryMapSlotForBaseClass<Base>();
+        impl::RegistryReadGuard guard;
+        const impl::FactorySnapshot * snapshot = slot.snapshot.load(std::memory_order_acquire);
+
+        const std::string * previous_name = nullptr;
+        for (std::size_t i = 0; i < count; ++i) {
+          const std::string & name = name_of(i);
+          if (nullptr == previous_name || *previous_name != name) {
+            factories[i] = impl::findFactory<Base>(snapshot, name, this);
+            previous_name = &name;
+          } else {
+            factories[i] = factories[i - 1];
+          }
+        }
+      }
 
-    if (managed) {
-      std::unique_lock<std::recursive_mutex> lock(plugin_ref_count_mutex_);
-      ++plugin_ref_count_;
+      threads = std::max<std::size_t>(1, std::min(threads, count));
+      std::vector<std::exception_ptr> errors(threads);
+      auto work = [&](std::size_t worker) {
+        try {
+          for (std::size_t i = worker * count / threads; i < (worker + 1) * count / threads; ++i) {
+            construct(i, *factories[i]);
+            constructed.fetch_add(1, std::memory_order_relaxed);
+            countCreations(*factories[i], 1);
+          }
+        } catch (...) {
+          errors[worker] = std::current_exception();
+        }
+      };
+      std::vector<std::thread> workers;
+      std::size_t started = 1;
+      try {
+        for (; started < threads; ++started) {
+          workers.emplace_back(work, started);
+        }
+      } catch (...) {
+        // Could not start another thread, the calling one takes over its share
+      }
+      for (std::size_t worker = started; worker < threads; ++worker) {
+        work(worker);
+      }
+      work(0);
+      for (auto & worker : workers) {
+        worker.join();
+      }
+      for (auto & worker_error : errors) {
+        if (worker_error) {
+          error = worker_error;
+          break;
+        }
+      }
+    } catch (...) {
+      error = std::current_exception();
     }
 
-    return obj;
+    if (error) {
+      // The objects already built give their references back when the caller drops them
+      for (std::size_t i = constructed; i < count; ++i) {
+        releasePluginReference();
+      }
+      std::rethrow_exception(error);
+    }
+  }
+
+  /**
+   * @brief Largest class constructed inside the control block of a shared instance. Larger classes, and
+   * over-aligned ones, get a second allocation from the same allocator.
+   */
+  static constexpr std::size_t MAX_SHARED_INSTANCE_SIZE = 1024;
+
+  /**
+   * @struct SharedInstance
+   * @brief What createSharedInstance() puts in the shared_ptr control block: the object storage plus what
+   * onPluginDeletion() needs. Destroying it runs the bookkeeping while the library is still loaded; the
+   * control block then releases the storage itself. Size is rounded up to a power of two so the number of
+   * instantiations per Base stays small.
+   */
+  template<class Base, std::size_t Size, class Allocator>
+  struct SharedInstance
+  {
+    SharedInstance(PluginLoader * loader, const Allocator &) : loader(loader), obj(nullptr) {}
+
+    ~SharedInstance()
+    {
+      if (nullptr != obj) {
+        loader->onPluginDeletion<Base>(obj, true);
+      }
+    }
+
+    SharedInstance(const SharedInstance &) = delete;
+    SharedInstance & operator=(const SharedInstance &) = delete;
+
+    void * allocate(const AbstractMetaObject<Base> &) {return storage;}
+
+    alignas(std::max_align_t) unsigned char storage[Size];
+    PluginLoader * loader;
+    Base * obj;
+  };
+
+  /**
+   * @brief SharedInstance of a class that does not fit MAX_SHARED_INSTANCE_SIZE: the object storage is
+   * allocated separately, but still through Allocator
+   */
+  template<class Base, class Allocator>
+  struct SharedInstance<Base, 0, Allocator>
+  {
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<unsigned char> ByteAllocator;
+    typedef std::allocator_traits<ByteAllocator> ByteTraits;
+
+    SharedInstance(PluginLoader * loader, const Allocator & allocator)
+    : loader(loader), obj(nullptr), bytes(allocator), storage(nullptr), storage_size(0)
+    {
+    }
+
+    ~SharedInstance()
+    {
+      if (nullptr != obj) {
+        loader->onPluginDeletion<Base>(obj, true);
+      }
+      if (nullptr != storage) {
+        ByteTraits::deallocate(bytes, storage, storage_size);
+      }
+    }
+
+    SharedInstance(const SharedInstance &) = delete;
+    SharedInstance & operator=(const SharedInstance &) = delete;
+
+    void * allocate(const AbstractMetaObject<Base> & factory)
+    {
+      std::size_t space = factory.objectSize() + factory.objectAlignment();
+      storage = ByteTraits::allocate(bytes, space);
+      storage_size = space;
+      void * ptr = storage;
+      return std::align(factory.objectAlignment(), factory.objectSize(), ptr, space);
+    }
+
+    PluginLoader * loader;
+    Base * obj;
+    ByteAllocator bytes;
+    unsigned char * storage;
+    std::size_t storage_size;
+  };
+
+  /**
+   * @brief Allocates the control block with allocator, then constructs the object in it with
+   * construct_in(void * storage). The storage exists before the constructor runs, so nothing can fail
+   * between creating the object and arming its deleter.
+   */
+  template<class Base, std::size_t Size = 16, class Allocator, class ConstructIn>
+  std::shared_ptr<Base> makeSharedInstance(
+    const AbstractMetaObject<Base> & factory, const Allocator & allocator, ConstructIn && construct_in)
+  {
+    if constexpr (Size <= MAX_SHARED_INSTANCE_SIZE) {
+      if (factory.objectSize() > Size || factory.objectAlignment() > alignof(std::max_align_t)) {
+        return makeSharedInstance<Base, Size * 2>(factory, allocator, std::forward<ConstructIn>(construct_in));
+      }
+    }
+    typedef SharedInstance<Base, (Size <= MAX_SHARED_INSTANCE_SIZE ? Size : 0), Allocator> Instance;
+    std::shared_ptr<Instance> instance = std::allocate_shared<Instance>(allocator, this, allocator);
+    instance->obj = construct_in(instance->allocate(factory));
+    return std::shared_ptr<Base>(instance, instance->obj);
+  }
+
+  /**
+   * @brief Same as above with the object default-constructed by factory.construct()
+   */
+  template<class Base, class Allocator = std::allocator<void>>
+  std::shared_ptr<Base> makeSharedInstance(
+    const AbstractMetaObject<Base> & factory, const Allocator & allocator = Allocator())
+  {
+    return makeSharedInstance<Base, 16>(factory, allocator,
+      [&factory](void * storage) {return factory.construct(storage);});
+  }
+
+  /**
+   * @brief Gets the entry points of factory taking Args, after checking they were registered with exactly those
+   * (decayed) types. Throws CreateClassException otherwise, instead of calling through a mismatched signature.
+   */
+  template<class Base, class... Args>
+  static const ArgumentFactory & getArgumentFactory(const AbstractMetaObject<Base> & factory)
+  {
+    const ArgumentFactory * arguments =
+      factory.findArgumentFactory(typeid(Base * (typename std::decay<Args>::type...)));
+    if (nullptr == arguments) {
+      throw plugin::CreateClassException(
+        "Class " + factory.className() + " was not registered with these constructor arguments");
+    }
+    return *arguments;
+  }
+
+  /**
+   * @brief Creates an object with new through the checked ArgumentFactory::create
+   */
+  template<class Base, class... Args>
+  static Base * createWithArguments(const AbstractMetaObject<Base> & factory, Args &&... args)
+  {
+    typedef Base * (*Create)(typename std::decay<Args>::type &&...);
+    Create create = reinterpret_cast<Create>(getArgumentFactory<Base, Args...>(factory).create);
+    return create(typename std::decay<Args>::type(std::forward<Args>(args))...);
+  }
+
+  template<class Base>
+  friend class FactoryHandle;
+
+  template<class Base>
+  friend class PluginDeleter;
+
+  template<class Base>
+  friend class InstancePool;
+
+  friend class MultiLibraryPluginLoader;
+
+  /**
+   * @brief Tag of the constructor that does not load the library, whatever ondemand_load_unload says
+   */
+  struct DeferLoad {};
+
+  /**
+   * @brief Same as the public constructor without loading the library, which is left to loadLibraryAsync()
+   */
+  PluginLoader(
+    DeferLoad, const std::string & library_path, bool ondemand_load_unload,
+    const SharedLibrary::LoadOptions & load_options);
+
+  /**
+   * @brief Drops the loads of pending_loads_ that are done and updates load_pending_
+   */
+  void forgetFinishedLoads();
+
+  /**
+   * @brief Gives up every load reference as soon as no instance created by this loader remains, right away if
+   * there is none. Meant for a superseded generation of a library, @see MultiLibraryPluginLoader::reloadLibrary()
+   */
+  void retire();
+
+  /**
+   * @brief Indicates if a retired loader gave its library up, after which it can be destroyed
+   */
+  bool isRetirementComplete() const
+  {
+    return retired_.load(std::memory_order_acquire) && 0 == load_ref_count_.load(std::memory_order_acquire);
   }
 
   /**
@@ -300,15 +953,191 @@ private:
   PLUGIN_LOADER_PUBLIC
   int unloadLibraryInternal(bool lock_plugin_ref_count);
 
+  /**
+   * @brief Indicates if class queries go to the manifest: there is one and this loader has not loaded the library
+   */
+  bool isAnsweredFromManifest() const
+  {
+    return hasManifest() && 0 == load_ref_count_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief Indicates if this loader holds a load reference of its own, unlike isLibraryLoaded() which is also true
+   * when another loader opened the library
+   */
+  bool holdsLoadReference() const
+  {
+    return load_ref_count_.load(std::memory_order_acquire) > 0;
+  }
+
+  /**
+   * @brief Checks the manifest against the just loaded library, once, and rejects it on mismatch.
+   * load_ref_count_mutex_ must be held.
+   */
+  void verifyManifest();
+
 private:
   bool ondemand_load_unload_;
   std::string library_path_;
-  int load_ref_count_;
+  SharedLibrary::LoadOptions load_options_;
+  std::atomic<int> load_ref_count_;  // Written under load_ref_count_mutex_, read without it
   std::recursive_mutex load_ref_count_mutex_;
-  int plugin_ref_count_;
-  std::recursive_mutex plugin_ref_count_mutex_;
+  std::atomic<int> plugin_ref_count_;
+  std::recursive_mutex plugin_ref_count_mutex_;  // Taken on the last reference and when unloading
+  std::unique_ptr<PluginManifest> manifest_;  // Set by loadManifest() only
+  bool manifest_verified_;  // Under load_ref_count_mutex_
+  std::atomic<bool> manifest_rejected_;
+  struct PendingLoad;
+  std::vector<std::shared_ptr<PendingLoad>> pending_loads_;  // Under pending_loads_mutex_
+  std::mutex pending_loads_mutex_;
+  std::atomic<bool> load_pending_;  // Set while pending_loads_ may hold a load that is not done yet
+  std::atomic<bool> retired_;
   PLUGIN_LOADER_PUBLIC
-  static bool has_unmananged_instance_been_created_;
+  static std::atomic<bool> has_unmananged_instance_been_created_;
+};
+
+template<class Base>
+void PluginDeleter<Base>::operator()(Base * obj) const
+{
+  if (nullptr == loader_) {
+    delete obj;
+    return;
+  }
+  loader_->onPluginDeletion<Base>(obj);
+}
+
+/**
+ * @class FactoryHandle
+ * @brief Pre-resolved factory of one plugin class, obtained from PluginLoader::getFactory().
+ *
+ * The handle remembers the factory together with the version of the registry snapshot it was found in. Every
+ * registry change for Base (a load, an unload, a new owner) publishes a snapshot with a new version, so while
+ * the versions match the cached factory is known to be alive and owned by the loader. A stale handle resolves
+ * again, or falls back to PluginLoader::createInstance() behaviour (including on-demand loading).
+ * A handle may be copied freely but a single handle must not be used by several threads at once.
+ */
+template<class Base>
+class FactoryHandle
+{
+public:
+  /**
+   * @brief Creates an instance, same as PluginLoader::createInstance()
+   */
+  std::shared_ptr<Base> create()
+  {
+    std::shared_ptr<Base> instance;
+    loader_->createRawInstance<Base>(*this, true,
+      [this, &instance](const AbstractMetaObject<Base> & factory) {
+        instance = loader_->makeSharedInstance<Base>(factory);
+        return instance.get();
+      });
+    return instance;
+  }
+
+  /**
+   * @brief Creates an instance, same as PluginLoader::createInstance() with a memory resource
+   */
+  std::shared_ptr<Base> create(std::pmr::memory_resource * resource)
+  {
+    std::shared_ptr<Base> instance;
+    loader_->createRawInstance<Base>(*this, true,
+      [this, &instance, resource](const AbstractMetaObject<Base> & factory) {
+        instance = loader_->makeSharedInstance<Base>(
+          factory, std::pmr::polymorphic_allocator<std::byte>(resource));
+        return instance.get();
+      });
+    return instance;
+  }
+
+  /**
+   * @brief Creates an instance, same as PluginLoader::createUniqueInstance()
+   */
+  PluginLoader::UniquePtr<Base> createUnique()
+  {
+    Base * raw = loader_->createRawInstance<Base>(*this, true, &FactoryHandle::createWithFactory);
+    return PluginLoader::UniquePtr<Base>(raw, PluginDeleter<Base>(loader_));
+  }
+
+  /**
+   * @brief Creates an instance, same as PluginLoader::createUnmanagedInstance()
+   */
+  Base * createUnmanaged()
+  {
+    return loader_->createRawInstance<Base>(*this, false, &FactoryHandle::createWithFactory);
+  }
+
+  /**
+   * @brief Gets the name of the class this handle creates
+   */
+  const std::string & getClassName() const {return class_name_;}
+
+  /**
+   * @brief Indicates if the handle currently holds a factory usable by its PluginLoader
+   */
+  bool isResolved() const {return factory_ != nullptr;}
+
+private:
+  friend class PluginLoader;
+
+  FactoryHandle(PluginLoader * loader, const std::string & class_name)
+  : loader_(loader), class_name_(class_name), factory_(nullptr), version_(0)
+  {
+  }
+
+  void resolve()
+  {
+    impl::FactoryMapSlot & slot = impl::getPublishedFactoryMapSlotForBaseClass<Base>();
+    impl::RegistryReadGuard guard;
+    const impl::FactorySnapshot * snapshot = slot.snapshot.load(std::memory_order_acquire);
+    if (nullptr != snapshot) {
+      resolve(*snapshot);
+    }
+  }
+
+  void resolve(const impl::FactorySnapshot & snapshot)
+  {
+    factory_ = nullptr;
+    version_ = snapshot.version;
+    auto itr = snapshot.factories.find(class_name_);
+    if (itr != snapshot.factories.end() &&
+      (itr->second.isOwnedBy(loader_) || itr->second.isOwnedBy(nullptr)))
+    {
+      factory_ = dynamic_cast<AbstractMetaObject<Base> *>(itr->second.factory);
+    }
+  }
+
+  static Base * createWithFactory(const AbstractMetaObject<Base> & factory)
+  {
+    return factory.create();
+  }
+
+  /**
+   * @brief Creates an instance through the cached factory
+   * @param construct - Materializes the object from the factory, see PluginLoader::createRawInstance()
+   * @return The new object, or nullptr if the handle does not resolve in the current snapshot
+   */
+  template<class Construct>
+  Base * tryCreate(Construct & construct)
+  {
+    impl::FactoryMapSlot & slot = impl::getPublishedFactoryMapSlotForBaseClass<Base>();
+    {
+      impl::RegistryReadGuard guard;
+      const impl::FactorySnapshot * snapshot = slot.snapshot.load(std::memory_order_acquire);
+      if (nullptr == snapshot) {
+        return nullptr;
+      }
+      if (snapshot->version != version_) {
+        resolve(*snapshot);
+      }
+    }
+    // Out of the read section, the plugin reference of the caller keeps the library loaded
+    return factory_ ? construct(*factory_) : nullptr;
+  }
+
+  PluginLoader * loader_;
+  std::string class_name_;
+  AbstractMetaObject<Base> * factory_;
+  unsigned long long version_;
 };
 
 } // namespace plugin
@@ -1,7 +1,13 @@
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
 
 #include "PluginLoaderCore.hpp"
 #include "PluginLoader.hpp"
+#include "UsageProfile.hpp"
 
 
 namespace plugin {
@@ -26,10 +32,9 @@ MetaObjectVector allMetaObjects()
 
 	MetaObjectVector all_meta_objs;
 	BaseToFactoryMapMap & factory_map_map = getGlobalPluginBaseToFactoryMapMap();
-	BaseToFactoryMapMap::iterator itr;
 
 	for (auto & it : factory_map_map) {
-		MetaObjectVector objs = allMetaObjects(it.second);
+		MetaObjectVector objs = allMetaObjects(it.second->factories);
 		all_meta_objs.insert(all_meta_objs.end(), objs.begin(), objs.end());
 	}
 	return all_meta_objs;
@@ -57,16 +62,162 @@ MetaObjectVector filterAllMetaObjectsAssociatedWithLibrary(MetaObjectVector cons
 	return filtered_objs;
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Library index
+// Every MetaObject that sits in a FactoryMap, or was retired from one by a newer generation of its library (@see
+// registerLibraryGeneration()), is also listed under its library, together with how many of them
+// each PluginLoader owns, so per-library questions cost O(classes in the library) instead of a walk over the
+// whole registry. Only touched under the registry mutex.
+//////////////////////////////////////////////////////////////////////////
+
+struct LibraryMetaObjects
+{
+	MetaObjectVector meta_objects;
+	std::vector<std::pair<const PluginLoader *, std::size_t>> owner_counts;
+
+	void addOwner(const PluginLoader * loader)
+	{
+		for (auto & owner : owner_counts) {
+			if (owner.first == loader) {
+				++owner.second;
+				return;
+			}
+		}
+		owner_counts.push_back(std::make_pair(loader, std::size_t(1)));
+	}
+
+	void removeOwner(const PluginLoader * loader)
+	{
+		for (auto itr = owner_counts.begin(); itr != owner_counts.end(); ++itr) {
+			if (itr->first == loader) {
+				if (0 == --itr->second) {
+					owner_counts.erase(itr);
+				}
+				return;
+			}
+		}
+	}
+
+	std::size_t countOwnedBy(const PluginLoader * loader) const
+	{
+		for (auto & owner : owner_counts) {
+			if (owner.first == loader) {
+				return owner.second;
+			}
+		}
+		return 0;
+	}
+};
+
+typedef FlatHashMap<LibraryMetaObjects> LibraryIndex;
+
+LibraryIndex & getLibraryIndex()
+{
+	static LibraryIndex instance;
+	return instance;
+}
+
+const LibraryMetaObjects * findLibraryMetaObjects(const std::string & library_path)
+{
+	LibraryIndex & index = getLibraryIndex();
+	LibraryIndex::iterator itr = index.find(library_path);
+	return itr != index.end() ? &itr->second : nullptr;
+}
+
+// Libraries linked into the executable (@see registerStaticLibrary()), never opened nor closed
+FlatHashMap<bool> & getStaticLibraryIndex()
+{
+	static FlatHashMap<bool> instance;
+	return instance;
+}
+
+// Copies opened to reload a library, with the path of the original (@see registerLibraryGeneration())
+FlatHashMap<std::string> & getLibraryGenerationIndex()
+{
+	static FlatHashMap<std::string> instance;
+	return instance;
+}
+
+const std::string & getOriginalLibraryPath(const std::string & library_path)
+{
+	const FlatHashMap<std::string> & index = getLibraryGenerationIndex();
+	FlatHashMap<std::string>::const_iterator itr = index.find(library_path);
+	return itr != index.end() ? itr->second : library_path;
+}
+
+// MetaObjects of an unloaded generation of a library, freed with the retired snapshots
+MetaObjectVector & getRetiredMetaObjects()
+{
+	static MetaObjectVector retired;
+	return retired;
+}
+
+void addMetaObjectToLibraryIndex(AbstractMetaObjectBase * meta_obj)
+{
+	LibraryMetaObjects & library = getLibraryIndex()[meta_obj->getAssociatedLibraryPath()];
+	library.meta_objects.push_back(meta_obj);
+	for (auto & loader : meta_obj->getAssociatedPluginLoaders()) {
+		library.addOwner(loader);
+	}
+}
+
+void removeMetaObjectFromLibraryIndex(AbstractMetaObjectBase * meta_obj)
+{
+	LibraryIndex & index = getLibraryIndex();
+	LibraryIndex::iterator itr = index.find(meta_obj->getAssociatedLibraryPath());
+	if (itr == index.end()) {
+		return;
+	}
+	LibraryMetaObjects & library = itr->second;
+	MetaObjectVector::iterator obj_itr = std::find(library.meta_objects.begin(), library.meta_objects.end(), meta_obj);
+	if (obj_itr == library.meta_objects.end()) {
+		return;
+	}
+	*obj_itr = library.meta_objects.back();
+	library.meta_objects.pop_back();
+	for (auto & loader : meta_obj->getAssociatedPluginLoaders()) {
+		library.removeOwner(loader);
+	}
+	if (library.meta_objects.empty()) {
+		index.erase(itr);
+	}
+}
+
+void addMetaObjectOwner(AbstractMetaObjectBase * meta_obj, PluginLoader * loader, LibraryMetaObjects & library)
+{
+	if (!meta_obj->isOwnedBy(loader)) {
+		meta_obj->addOwningPluginLoader(loader);
+		library.addOwner(loader);
+	}
+}
+
+void removeMetaObjectOwner(AbstractMetaObjectBase * meta_obj, const PluginLoader * loader, LibraryMetaObjects & library)
+{
+	if (meta_obj->isOwnedBy(loader)) {
+		meta_obj->removeOwningPluginLoader(loader);
+		library.removeOwner(loader);
+	}
+}
+
+// End of Library index
+// ------------------------------------------------------------------------------------------------------------------------- //
+
+// The filters dereference the MetaObjects, so they run under the registry mutex: a concurrent load may purge
+// (delete) graveyard MetaObjects as soon as it is released.
 MetaObjectVector allMetaObjectsForPluginLoader(const PluginLoader * owner)
 {
+	std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
 	return filterAllMetaObjectsOwnedBy(allMetaObjects(), owner);
 }
 
 MetaObjectVector allMetaObjectsForLibrary(const std::string & library_path){
-	return filterAllMetaObjectsAssociatedWithLibrary(allMetaObjects(), library_path);
+	std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+	const LibraryMetaObjects * library = findLibraryMetaObjects(library_path);
+	return library ? library->meta_objects : MetaObjectVector();
 }
 
 MetaObjectVector allMetaObjectsForLibraryOwnedBy(const std::string & library_path, const PluginLoader * owner) {
+	std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
 	return filterAllMetaObjectsOwnedBy(allMetaObjectsForLibrary(library_path), owner);
 }
 
@@ -80,40 +231,57 @@ void insertMetaObjectIntoGraveyard(AbstractMetaObjectBase* meta_obj)
 	getMetaObjectGraveyard().push_back(meta_obj);
 }
 
-void destroyMetaObjectsForLibrary(
-	const std::string & library_path, FactoryMap & factories, const PluginLoader * loader)
-{
-	FactoryMap::iterator factory_itr = factories.begin();
-	while (factory_itr != factories.end()) {
-		AbstractMetaObjectBase * meta_obj = factory_itr->second;
-		if (meta_obj->getAssociatedLibraryPath() == library_path && meta_obj->isOwnedBy(loader)) {
-			meta_obj->removeOwningPluginLoader(loader);
-			if (!meta_obj->isOwnedByAnybody()) {
-				FactoryMap::iterator factory_itr_copy = factory_itr;
-				factory_itr++;
-				// TODO(mikaelarguedas) fix this when branching out for melodic
-				// Note: map::erase does not return iterator like vector::erase does.
-				// Hence the ugliness of this code and a need for copy. Should be fixed in next C++ revision
-				factories.erase(factory_itr_copy);
-
-				// Insert into graveyard
-				// We remove the metaobject from its factory map, but we don't destroy it...instead it
-				// saved to a "graveyard" to the side.
-				// This is due to our static global variable initialization problem that causes factories
-				// to not be registered when a library is closed and then reopened.
-				// This is because it's truly not closed due to the use of global symbol binding i.e.
-				// calling dlopen with RTLD_GLOBAL instead of RTLD_LOCAL.
-				// We require using the former as the which is required to support RTTI
-				insertMetaObjectIntoGraveyard(meta_obj);
-			}
-			else {
-				++factory_itr;
-			}
-		}
-		else {
-			++factory_itr;
-		}
+// The only place where MetaObjects are destroyed
+void destroyMetaObject(AbstractMetaObjectBase * meta_obj)
+{
+#ifndef _WIN32
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdelete-non-virtual-dtor"
+#endif
+	delete (meta_obj);
+#ifndef _WIN32
+#pragma GCC diagnostic pop
+#endif
+}
+
+void markFactoryMapDirty(AbstractMetaObjectBase * meta_obj)
+{
+	getFactoryMapSlotForBaseClass(meta_obj->typeidBaseClassName()).dirty.store(true, std::memory_order_release);
+}
+
+void insertMetaObjectIntoFactoryMap(FactoryMapSlot & slot, AbstractMetaObjectBase * meta_obj)
+{
+	std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+	AbstractMetaObjectBase *& entry = slot.factories[meta_obj->className()];
+	if (entry == meta_obj) {
+		return;
+	}
+	if (entry != nullptr && !isNamespaceCollision(slot, meta_obj)) {
+		// Superseded by a newer generation of its library: it stays indexed with its library, whose unload destroys it
+		logDebug(
+		  "plugin_loader.impl: "
+		  "Retiring MetaObject %p (class = %s, library path = %s) in favour of the one of library %s.",
+		  reinterpret_cast<void *>(entry), entry->className().c_str(),
+		  entry->getAssociatedLibraryPath().c_str(), meta_obj->getAssociatedLibraryPath().c_str());
 	}
+	else if (entry != nullptr) {
+		// Namespace collision, the previous factory is no longer reachable
+		removeMetaObjectFromLibraryIndex(entry);
+	}
+	entry = meta_obj;
+	addMetaObjectToLibraryIndex(meta_obj);
+	slot.dirty.store(true, std::memory_order_release);
+}
+
+bool isNamespaceCollision(FactoryMapSlot & slot, AbstractMetaObjectBase * meta_obj)
+{
+	std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+	FactoryMap::iterator itr = slot.factories.find(meta_obj->className());
+	if (itr == slot.factories.end() || itr->second == meta_obj) {
+		return false;
+	}
+	return getOriginalLibraryPath(itr->second->getAssociatedLibraryPath()) !=
+		getOriginalLibraryPath(meta_obj->getAssociatedLibraryPath());
 }
 
 void destroyMetaObjectsForLibrary(const std::string & library_path, const PluginLoader * loader)
@@ -125,16 +293,51 @@ void destroyMetaObjectsForLibrary(const std::string & library_path, const Plugin
 	  "plugin-to-factorymap map.\n",
 	  library_path.c_str(), reinterpret_cast<const void *>(loader));
 
-	// We have to walk through all FactoryMaps to be sure
-	BaseToFactoryMapMap& factory_map_map = getGlobalPluginBaseToFactoryMapMap();
-	for (auto& it : factory_map_map) {
-		destroyMetaObjectsForLibrary(library_path, it.second, loader);
+	LibraryIndex & index = getLibraryIndex();
+	LibraryIndex::iterator library_itr = index.find(library_path);
+	if (library_itr == index.end() || 0 == library_itr->second.countOwnedBy(loader)) {
+		logDebug("%s", "plugin_loader.impl: Metaobjects removed.");
+		return;
+	}
+
+	// Copy: erasing the last MetaObject of the library drops its index entry
+	MetaObjectVector meta_objs = library_itr->second.meta_objects;
+	for (auto & meta_obj : meta_objs) {
+		LibraryMetaObjects & library = index.find(library_path)->second;
+		if (!meta_obj->isOwnedBy(loader)) {
+			continue;
+		}
+		removeMetaObjectOwner(meta_obj, loader, library);
+		FactoryMapSlot & slot = getFactoryMapSlotForBaseClass(meta_obj->typeidBaseClassName());
+		slot.dirty.store(true, std::memory_order_release);
+		if (!meta_obj->isOwnedByAnybody()) {
+			removeMetaObjectFromLibraryIndex(meta_obj);
+			FactoryMap::iterator factory_itr = slot.factories.find(meta_obj->className());
+			if (factory_itr == slot.factories.end() || factory_itr->second != meta_obj) {
+				// Retired by a newer generation of the library, which nothing revives: destroyed once no reader
+				// can see it anymore
+				getRetiredMetaObjects().push_back(meta_obj);
+				continue;
+			}
+			slot.factories.erase(factory_itr);
+
+			// Insert into graveyard
+			// We remove the metaobject from its factory map, but we don't destroy it...instead it
+			// saved to a "graveyard" to the side.
+			// This is due to our static global variable initialization problem that causes factories
+			// to not be registered when a library is closed and then reopened.
+			// This is because it's truly not closed due to the use of global symbol binding i.e.
+			// calling dlopen with RTLD_GLOBAL instead of RTLD_LOCAL.
+			// We require using the former as the which is required to support RTTI
+			insertMetaObjectIntoGraveyard(meta_obj);
+		}
 	}
 	logDebug("%s", "plugin_loader.impl: Metaobjects removed.");
 }
 
 bool areThereAnyExistingMetaObjectsForLibrary(const std::string & library_path) {
-	return !allMetaObjectsForLibrary(library_path).empty();
+	std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+	return findLibraryMetaObjects(library_path) != nullptr;
 }
 
 // end of MetaObject search/insert/removal/query
@@ -173,15 +376,21 @@ std::string getCurrentlyLoadingLibraryName() {
 }
 
 
-FactoryMap& getFactoryMapForBaseClass(const std::string & typeid_base_class_name)
+FactoryMapSlot& getFactoryMapSlotForBaseClass(const std::string & typeid_base_class_name)
 {
+	std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
 	BaseToFactoryMapMap & factoryMapMap = getGlobalPluginBaseToFactoryMapMap();
-	std::string base_class_name = typeid_base_class_name;
-	if (factoryMapMap.find(base_class_name) == factoryMapMap.end()) {
-		factoryMapMap[base_class_name] = FactoryMap();
+	std::unique_ptr<FactoryMapSlot> & slot = factoryMapMap[typeid_base_class_name];
+	if (!slot) {
+		slot.reset(new FactoryMapSlot());
 	}
 
-	return factoryMapMap[base_class_name];
+	return *slot;
+}
+
+FactoryMap& getFactoryMapForBaseClass(const std::string & typeid_base_class_name)
+{
+	return getFactoryMapSlotForBaseClass(typeid_base_class_name).factories;
 }
 
 
@@ -210,18 +419,209 @@ void setCurrentlyLoadingLibraryName(const std::string& library_name)
 // End of Global data area
 // ------------------------------------------------------------------------------------------------------------------------- //
 
+//////////////////////////////////////////////////////////////////////////
+// Registry snapshots
+// Readers announce themselves on one of READER_SHARD_COUNT cache-line sized counter pairs, picked per thread.
+// A writer swaps in the new snapshot, flips the reader epoch and waits until the counter of the old epoch parity
+// drains, after which nobody can still hold the snapshot it replaced.
+//////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const unsigned READER_SHARD_COUNT = 64;
+
+struct alignas(64) ReaderShard
+{
+	std::atomic<long> readers[2];
+};
+
+struct ReaderState
+{
+	unsigned shard;
+	long sections[2];  // Sections the thread itself holds, per epoch parity
+};
+
+ReaderShard g_reader_shards[READER_SHARD_COUNT];
+std::atomic<unsigned> g_reader_epoch(0);
+std::atomic<unsigned> g_next_reader_shard(0);
+std::atomic<unsigned long long> g_registry_version(0);
+std::mutex g_grace_period_mutex;  // Serializes waitForRegistryReaders()
+thread_local unsigned g_deferred_snapshot_depth = 0;
+
+ReaderState & getReaderState()
+{
+	thread_local ReaderState state = {
+		g_next_reader_shard.fetch_add(1, std::memory_order_relaxed) % READER_SHARD_COUNT, {0, 0}};
+	return state;
+}
+
+std::vector<const FactorySnapshot*> & getRetiredFactorySnapshots()
+{
+	static std::vector<const FactorySnapshot*> retired;
+	return retired;
+}
+
+/**
+ * @brief Waits until every read section that could have seen the snapshots replaced so far has ended.
+ * Sections held by the calling thread itself are not waited for. Must be called with g_grace_period_mutex held,
+ * and no other lock: read sections never block, but the threads holding them may be about to take a lock.
+ */
+void waitForRegistryReaders()
+{
+	const ReaderState & state = getReaderState();
+	unsigned parity = g_reader_epoch.fetch_add(1) & 1;
+	for (unsigned spins = 0; ; ++spins) {
+		long readers = 0;
+		for (const ReaderShard & shard : g_reader_shards) {
+			readers += shard.readers[parity].load();
+		}
+		if (readers == state.sections[parity]) {
+			return;
+		}
+		if (spins > 64) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+FactorySnapshot * makeFactorySnapshot(const FactoryMap & factories)
+{
+	FactorySnapshot * snapshot = new FactorySnapshot();
+	snapshot->version = ++g_registry_version;
+	snapshot->factories.reserve(factories.size());
+	for (auto & it : factories) {
+		FactorySnapshotEntry & entry = snapshot->factories[it.first];
+		entry.factory = it.second;
+		entry.owners = it.second->getAssociatedPluginLoaders();
+	}
+	return snapshot;
+}
+
+} // namespace
+
+unsigned enterRegistryReadSection()
+{
+	ReaderState & state = getReaderState();
+	ReaderShard & shard = g_reader_shards[state.shard];
+	for (;;) {
+		unsigned epoch = g_reader_epoch.load();
+		unsigned parity = epoch & 1;
+		shard.readers[parity].fetch_add(1);
+		// A writer that flipped the epoch in between may already have sampled this counter
+		if (g_reader_epoch.load() == epoch) {
+			++state.sections[parity];
+			return parity;
+		}
+		shard.readers[parity].fetch_sub(1);
+	}
+}
+
+void exitRegistryReadSection(unsigned ticket)
+{
+	ReaderState & state = getReaderState();
+	--state.sections[ticket];
+	g_reader_shards[state.shard].readers[ticket].fetch_sub(1, std::memory_order_release);
+}
+
+void publishFactoryMapSnapshots()
+{
+	std::vector<const FactorySnapshot*> retired;
+	MetaObjectVector retired_meta_objects;
+	{
+		std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+		// Those left by a publish made from inside a read section are reclaimed along
+		retired.swap(getRetiredFactorySnapshots());
+		retired_meta_objects.swap(getRetiredMetaObjects());
+		for (auto & it : getGlobalPluginBaseToFactoryMapMap()) {
+			FactoryMapSlot & slot = *it.second;
+			if (!slot.dirty.load(std::memory_order_acquire)) {
+				continue;
+			}
+			slot.dirty.store(false, std::memory_order_relaxed);
+			const FactorySnapshot * old_snapshot = slot.snapshot.exchange(makeFactorySnapshot(slot.factories));
+			if (old_snapshot != nullptr) {
+				retired.push_back(old_snapshot);
+			}
+		}
+	}
+	if (retired.empty() && retired_meta_objects.empty()) {
+		return;
+	}
+
+	// The registry mutex is released first: a reader must not wait on the writer that waits on it
+	{
+		std::unique_lock<std::mutex> grace_lock(g_grace_period_mutex);
+		waitForRegistryReaders();
+	}
+
+	const ReaderState & state = getReaderState();
+	if (state.sections[0] + state.sections[1] > 0) {
+		// Called from inside a read section (e.g. a visitor loading a library): the caller may still hold one of
+		// the retired snapshots, so they are freed by the next publish made outside of one.
+		std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+		std::vector<const FactorySnapshot*> & pending = getRetiredFactorySnapshots();
+		pending.insert(pending.end(), retired.begin(), retired.end());
+		MetaObjectVector & pending_meta_objects = getRetiredMetaObjects();
+		pending_meta_objects.insert(pending_meta_objects.end(), retired_meta_objects.begin(), retired_meta_objects.end());
+		return;
+	}
+	for (const FactorySnapshot * snapshot : retired) {
+		delete snapshot;
+	}
+	for (AbstractMetaObjectBase * meta_obj : retired_meta_objects) {
+		logDebug(
+		  "plugin_loader.impl: "
+		  "Destroying retired metaobject %p (class = %s, library_path = %s).",
+		  reinterpret_cast<void *>(meta_obj), meta_obj->className().c_str(),
+		  meta_obj->getAssociatedLibraryPath().c_str());
+		destroyMetaObject(meta_obj);
+	}
+}
+
+void refreshFactoryMapSnapshots()
+{
+	const ReaderState & state = getReaderState();
+	if (state.sections[0] + state.sections[1] > 0) {
+		return;
+	}
+	publishFactoryMapSnapshots();
+}
+
+void deferFactoryMapSnapshots()
+{
+	++g_deferred_snapshot_depth;
+}
+
+void resumeFactoryMapSnapshots()
+{
+	assert(g_deferred_snapshot_depth > 0);
+	--g_deferred_snapshot_depth;
+}
+
+bool areFactoryMapSnapshotsDeferred()
+{
+	return g_deferred_snapshot_depth > 0;
+}
+
+unsigned long long getRegistryVersion()
+{
+	return g_registry_version.load(std::memory_order_acquire);
+}
+
+// End of Registry snapshots
+// ------------------------------------------------------------------------------------------------------------------------- //
+
 //////////////////////////////////////////////////////////////////////////
 // Implementation of Remaining Core plugin impl Functions
 //////////////////////////////////////////////////////////////////////////
 
 std::vector<std::string> getAllLibrariesUsedByPluginLoader(const PluginLoader * loader)
 {
-	MetaObjectVector all_loader_meta_objs = allMetaObjectsForPluginLoader(loader);
+	std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
 	std::vector<std::string> all_libs;
-	for (auto & meta_obj : all_loader_meta_objs) {
-		std::string lib_path = meta_obj->getAssociatedLibraryPath();
-		if (std::find(all_libs.begin(), all_libs.end(), lib_path) == all_libs.end()) {
-			all_libs.push_back(lib_path);
+	for (auto & it : getLibraryIndex()) {
+		if (it.second.countOwnedBy(loader) > 0) {
+			all_libs.push_back(it.first);
 		}
 	}
 	return all_libs;
@@ -229,15 +629,11 @@ std::vector<std::string> getAllLibrariesUsedByPluginLoader(const PluginLoader *
 
 bool isLibraryLoaded(const std::string & library_path, PluginLoader * loader)
 {
-	bool is_lib_loaded_by_anyone = isLibraryLoadedByAnybody(library_path);
-	size_t num_meta_objs_for_lib = allMetaObjectsForLibrary(library_path).size();
-	size_t num_meta_objs_for_lib_bound_to_loader =
-		allMetaObjectsForLibraryOwnedBy(library_path, loader).size();
-	bool are_meta_objs_bound_to_loader =
-		(0 == num_meta_objs_for_lib) ? true : (
-			num_meta_objs_for_lib_bound_to_loader <= num_meta_objs_for_lib);
-
-	return is_lib_loaded_by_anyone && are_meta_objs_bound_to_loader;
+	// The MetaObjects bound to loader are always a subset of those of the library, so the ownership test
+	// that used to be computed here never changed the result. Skipping it keeps the registry mutex off the
+	// createInstance() path, which asks this on every call.
+	(void)loader;
+	return isLibraryLoadedByAnybody(library_path);
 }
 
 bool isLibraryLoadedByAnybody(const std::string & library_path)
@@ -248,7 +644,8 @@ bool isLibraryLoadedByAnybody(const std::string & library_path)
 	LibraryVector::iterator itr = findLoadedLibrary(library_path);
 
 	if (itr != open_libraries.end()) {
-		assert(itr->second->isLoaded() == true);  // Ensure Osstem actually thinks the library is loaded
+		// Ensure Osstem actually thinks the library is loaded. Static libraries have no handle.
+		assert(nullptr == itr->second || itr->second->isLoaded() == true);
 		return true;
 	}
 	else {
@@ -259,8 +656,13 @@ bool isLibraryLoadedByAnybody(const std::string & library_path)
 void addPluginLoaderOwnerForAllExistingMetaObjectsForLibrary(
 	const std::string & library_path, PluginLoader * loader)
 {
-	MetaObjectVector all_meta_objs = allMetaObjectsForLibrary(library_path);
-	for (auto & meta_obj : all_meta_objs) {
+	std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+	LibraryIndex & index = getLibraryIndex();
+	LibraryIndex::iterator library_itr = index.find(library_path);
+	if (library_itr == index.end()) {
+		return;
+	}
+	for (auto & meta_obj : library_itr->second.meta_objects) {
 		logDebug(
 		  "plugin_loader.impl: "
 		  "Tagging existing MetaObject %p (base = %s, derived = %s) with "
@@ -269,7 +671,8 @@ void addPluginLoaderOwnerForAllExistingMetaObjectsForLibrary(
 		  meta_obj->className().c_str(),
 		  reinterpret_cast<void *>(loader),
 		  nullptr == loader ? loader->getLibraryPath().c_str() : "NULL");
-		meta_obj->addOwningPluginLoader(loader);
+		addMetaObjectOwner(meta_obj, loader, library_itr->second);
+		markFactoryMapDirty(meta_obj);
 	}
 }
 
@@ -290,8 +693,7 @@ void revivePreviouslyCreateMetaobjectsFromGraveyard(std::string const& library_p
 
 			obj->addOwningPluginLoader(loader);
 			assert(obj->typeidBaseClassName() != "UNSET");
-			FactoryMap & factory = getFactoryMapForBaseClass(obj->typeidBaseClassName());
-			factory[obj->className()] = obj;
+			insertMetaObjectIntoFactoryMap(getFactoryMapSlotForBaseClass(obj->typeidBaseClassName()), obj);
 		}
 	}
 }
@@ -299,9 +701,8 @@ void revivePreviouslyCreateMetaobjectsFromGraveyard(std::string const& library_p
 void purgeGraveyardOfMetaobjects(
 	const std::string & library_path, PluginLoader* loader, bool delete_objs)
 {
-	MetaObjectVector all_meta_objs = allMetaObjects();
-	// Note: Lock must happen after call to allMetaObjects as that will lock
 	std::unique_lock<std::recursive_mutex> b2fmm_lock(getPluginBaseToFactoryMapMapMutex());
+	const LibraryMetaObjects * library = findLibraryMetaObjects(library_path);
 
 	MetaObjectVector & graveyard = getMetaObjectGraveyard();
 	MetaObjectVector::iterator itr = graveyard.begin();
@@ -317,8 +718,8 @@ void purgeGraveyardOfMetaobjects(
 			  reinterpret_cast<void *>(loader),
 			  nullptr == loader ? loader->getLibraryPath().c_str() : "NULL");
 
-			bool is_address_in_graveyard_same_as_global_factory_map =
-				std::find(all_meta_objs.begin(), all_meta_objs.end(), *itr) != all_meta_objs.end();
+			bool is_address_in_graveyard_same_as_global_factory_map = library &&
+				std::find(library->meta_objects.begin(), library->meta_objects.end(), *itr) != library->meta_objects.end();
 			itr = graveyard.erase(itr);
 			if (delete_objs) {
 				if (is_address_in_graveyard_same_as_global_factory_map) {
@@ -335,14 +736,7 @@ void purgeGraveyardOfMetaobjects(
 					    "in addition to purging it from graveyard.",
 					    reinterpret_cast<void *>(obj), obj->className().c_str(), obj->baseClassName().c_str(),
 					    obj->getAssociatedLibraryPath().c_str());
-#ifndef _WIN32
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wdelete-non-virtual-dtor"
-#endif
-					delete (obj);  // Note: This is the only place where metaobjects can be destroyed
-#ifndef _WIN32
-#pragma GCC diagnostic pop
-#endif
+					destroyMetaObject(obj);
 				}
 			}
 		}
@@ -352,56 +746,229 @@ void purgeGraveyardOfMetaobjects(
 	}
 }
 
-void loadLibrary(const std::string & library_path, PluginLoader* loader)
+void registerStaticLibrary(const std::string & library_path, const MetaObjectVector & meta_objects)
+{
+	// Loaded library vector first, in the order unloadLibrary() takes both mutexes
+	std::unique_lock<std::recursive_mutex> llv_lock(getLoadedLibraryVectorMutex());
+	std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+	bool & registered = getStaticLibraryIndex()[library_path];
+	if (registered || isLibraryLoadedByAnybody(library_path)) {
+		for (auto & meta_obj : meta_objects) {
+			destroyMetaObject(meta_obj);
+		}
+		throw plugin::LibraryLoadException("Static plugin library already registered or loaded: " + library_path);
+	}
+	registered = true;
+
+	logDebug(
+	  "plugin_loader.impl: "
+	  "Registering static plugin library %s with %zu factory metaobjects.",
+	  library_path.c_str(), meta_objects.size());
+	// Parked in the graveyard like the factories of an unloaded library: loadLibrary() revives them
+	MetaObjectVector & graveyard = getMetaObjectGraveyard();
+	graveyard.reserve(graveyard.size() + meta_objects.size());
+	for (auto & meta_obj : meta_objects) {
+		meta_obj->setAssociatedLibraryPath(library_path);
+		graveyard.push_back(meta_obj);
+	}
+}
+
+bool isStaticLibrary(const std::string & library_path)
+{
+	std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+	FlatHashMap<bool> & index = getStaticLibraryIndex();
+	return index.find(library_path) != index.end();
+}
+
+void registerLibraryGeneration(const std::string & image_path, const std::string & library_path)
+{
+	std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+	getLibraryGenerationIndex()[image_path] = getOriginalLibraryPath(library_path);
+}
+
+void unregisterLibraryGeneration(const std::string & image_path)
+{
+	std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+	getLibraryGenerationIndex().erase(image_path);
+}
+
+// Registers the classes of a library that exports a LibraryDescriptor (@see PLUGIN_LOADER_REGISTER_LIBRARY) under
+// one lock, with the factory maps and the library index sized for all of them up front
+void registerLibraryDescriptor(SharedLibrary & library, const std::string & library_path, PluginLoader* loader)
+{
+	const LibraryDescriptor * descriptor = static_cast<const LibraryDescriptor *>(
+		library.findOwnSymbol(PLUGIN_LOADER_LIBRARY_DESCRIPTOR_SYMBOL));
+	if (nullptr == descriptor) {
+		return;
+	}
+	if (descriptor->version != PLUGIN_LOADER_LIBRARY_DESCRIPTOR_VERSION) {
+		logWarn(
+		  "plugin_loader.impl: "
+		  "Ignoring the class table of library %s, built for descriptor version %u instead of %u.",
+		  library_path.c_str(), descriptor->version, PLUGIN_LOADER_LIBRARY_DESCRIPTOR_VERSION);
+		return;
+	}
+	// An index entry, even empty, counts as MetaObjects of the library (@see areThereAnyExistingMetaObjectsForLibrary())
+	if (0 == descriptor->class_count) {
+		return;
+	}
+
+	std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+	getLibraryIndex()[library_path].meta_objects.reserve(descriptor->class_count);
+	FactoryMapSlot * slot = nullptr;
+	std::string typeid_base_class_name;
+	for (std::size_t i = 0; i < descriptor->class_count; ++i) {
+		const PluginDescriptor & plugin = descriptor->classes[i];
+		AbstractMetaObjectBase * meta_obj = plugin.make_factory(plugin.class_name, plugin.base_class_name);
+		meta_obj->addOwningPluginLoader(loader);
+		meta_obj->setAssociatedLibraryPath(library_path);
+
+		// Classes of a library usually share their base: only look the slot up again when it changes
+		if (nullptr == slot || meta_obj->typeidBaseClassName() != typeid_base_class_name) {
+			typeid_base_class_name = meta_obj->typeidBaseClassName();
+			slot = &getFactoryMapSlotForBaseClass(typeid_base_class_name);
+			slot->factories.reserve(slot->factories.size() + descriptor->class_count - i);
+		}
+		if (isNamespaceCollision(*slot, meta_obj)) {
+			logWarn(
+			  "plugin_loader.impl: SEVERE WARNING!!! "
+			  "A namespace collision has occured with plugin factory for class %s. "
+			  "New factory from library %s will OVERWRITE existing one.",
+			  plugin.class_name, library_path.c_str());
+		}
+		insertMetaObjectIntoFactoryMap(*slot, meta_obj);
+	}
+
+	logDebug(
+	  "plugin_loader.impl: "
+	  "Registered %zu factory metaobjects from the class table of library %s.",
+	  descriptor->class_count, library_path.c_str());
+}
+
+namespace {
+
+struct LibraryLock
+{
+	std::recursive_mutex mutex;
+	std::size_t users = 0;
+};
+
+std::mutex & getLibraryLocksMutex()
+{
+	static std::mutex m;
+	return m;
+}
+
+FlatHashMap<std::unique_ptr<LibraryLock>> & getLibraryLocks()
+{
+	static FlatHashMap<std::unique_ptr<LibraryLock>> locks;
+	return locks;
+}
+
+/**
+ * @brief Serializes the loads and unloads of one library, so that loads of different libraries overlap.
+ * The lock is recursive since a plugin may load or unload its own library from a static initializer.
+ */
+class ScopedLibraryLock
+{
+public:
+	explicit ScopedLibraryLock(const std::string & library_path)
+		: library_path_(library_path)
+	{
+		{
+			std::unique_lock<std::mutex> lock(getLibraryLocksMutex());
+			std::unique_ptr<LibraryLock> & library_lock = getLibraryLocks()[library_path_];
+			if (!library_lock) {
+				library_lock.reset(new LibraryLock());
+			}
+			++library_lock->users;
+			library_lock_ = library_lock.get();
+		}
+		library_lock_->mutex.lock();
+	}
+
+	~ScopedLibraryLock()
+	{
+		library_lock_->mutex.unlock();
+		std::unique_lock<std::mutex> lock(getLibraryLocksMutex());
+		if (0 == --library_lock_->users) {
+			getLibraryLocks().erase(library_path_);
+		}
+	}
+
+	ScopedLibraryLock(const ScopedLibraryLock &) = delete;
+	ScopedLibraryLock & operator=(const ScopedLibraryLock &) = delete;
+
+private:
+	std::string library_path_;
+	LibraryLock * library_lock_;
+};
+
+} // namespace
+
+void loadLibrary(const std::string & library_path, PluginLoader* loader,
+	const SharedLibrary::LoadOptions & options)
 {
-	static std::recursive_mutex loader_mutex;
 	logDebug(
 	  "plugin_loader.impl: "
 	  "Attempting to load library %s on behalf of PluginLoader handle %p...\n",
 	  library_path.c_str(), reinterpret_cast<void *>(loader));
-	std::unique_lock<std::recursive_mutex> loader_lock(loader_mutex);
+	// Only this library is locked: the loading context is thread local and the registry has its own mutex, so
+	// other libraries can be opened by other threads meanwhile
+	ScopedLibraryLock library_lock(library_path);
 
 
-	// If it's already open, just update existing metaobjects to have an additional owner.
+	// If it's already open, just update existing metaobjects to have an additional owner. The library lock keeps
+	// it from being unloaded meanwhile.
 	if (isLibraryLoadedByAnybody(library_path)) {
-		std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
 		logDebug("%s",
 			"class_loader.impl: "
 			"Library already in memory, but binding existing MetaObjects to loader if necesesary.\n");
 		addPluginLoaderOwnerForAllExistingMetaObjectsForLibrary(library_path, loader);
+		if (!areFactoryMapSnapshotsDeferred()) {
+			publishFactoryMapSnapshots();
+		}
 		return;
 	}
 
 
 
+	const std::chrono::steady_clock::time_point load_start = std::chrono::steady_clock::now();
 	SharedLibrary* library_handle = nullptr;
-	{
+	bool is_static = isStaticLibrary(library_path);
+	if (!is_static) {
+		// Restored afterwards for a load nested in the static initializer of another library
+		PluginLoader * const previous_loader = getCurrentlyActivePluginLoader();
+		const std::string previous_library_name = getCurrentlyLoadingLibraryName();
 		try {
 			setCurrentlyActivePluginLoader(loader);
 			setCurrentlyLoadingLibraryName(library_path);
-			library_handle = new SharedLibrary(library_path);
+			library_handle = new SharedLibrary(library_path, options);
 		}
 		catch (const plugin::LibraryLoadException& e)
 		{
-			setCurrentlyLoadingLibraryName("");
-			setCurrentlyActivePluginLoader(nullptr);
+			setCurrentlyLoadingLibraryName(previous_library_name);
+			setCurrentlyActivePluginLoader(previous_loader);
 			throw e;
 		}
 
-		setCurrentlyLoadingLibraryName("");
-		setCurrentlyActivePluginLoader(nullptr);
+		setCurrentlyLoadingLibraryName(previous_library_name);
+		setCurrentlyActivePluginLoader(previous_loader);
 	}
 
-	assert(library_handle != nullptr);
+	assert(is_static || library_handle != nullptr);
 
 	logDebug(
 	"plugin_loader.impl: "
 	"Successfully loaded library %s into memory (SharedLibrary handle = %p).",
 	library_path.c_str(), reinterpret_cast<void *>(library_handle));
 
+	if (library_handle != nullptr) {
+		registerLibraryDescriptor(*library_handle, library_path, loader);
+	}
+
 	// Graveyard scenario
-	size_t num_lib_objs = allMetaObjectsForLibrary(library_path).size();
-	if (0 == num_lib_objs) {
+	if (!areThereAnyExistingMetaObjectsForLibrary(library_path)) {
 		logDebug(
 		  "plugin_loader.impl: "
 		  "Though the library %s was just loaded, it seems no factory metaobjects were registered. "
@@ -425,7 +992,16 @@ void loadLibrary(const std::string & library_path, PluginLoader* loader)
 	LibraryVector& open_libraries = getLoadedLibraryVector();
 	// Note: SharedLibrary automatically calls load() when library passed to constructor
 	open_libraries.push_back(LibraryPair(library_path, library_handle));
+	llv_lock.unlock();
+
+	if (UsageProfile::isRecording()) {
+		UsageProfile::recordLoad(library_path, static_cast<std::uint64_t>(
+			std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - load_start).count()));
+	}
 
+	if (!areFactoryMapSnapshotsDeferred()) {
+		publishFactoryMapSnapshots();
+	}
 }
 	
 void unloadLibrary(std::string const& library_path, PluginLoader* loader)
@@ -446,47 +1022,56 @@ void unloadLibrary(std::string const& library_path, PluginLoader* loader)
 			"plugin_loader.impl: "
 			"Unloading library %s on behalf of PluginLoader %p...",
 			library_path.c_str(), reinterpret_cast<void *>(loader));
-		std::unique_lock<std::recursive_mutex> lock(getLoadedLibraryVectorMutex());
-		LibraryVector& open_libraries = getLoadedLibraryVector();
-		LibraryVector::iterator itr = findLoadedLibrary(library_path);
-		if (itr != open_libraries.end()) {
-			SharedLibrary * library = itr->second;
-			std::string library_path = itr->first;
+		ScopedLibraryLock library_lock(library_path);
+		SharedLibrary * library = nullptr;
+		bool is_last_owner = false;
+		{
+			std::unique_lock<std::recursive_mutex> lock(getLoadedLibraryVectorMutex());
+			LibraryVector& open_libraries = getLoadedLibraryVector();
+			LibraryVector::iterator itr = findLoadedLibrary(library_path);
+			if (itr == open_libraries.end()) {
+				throw plugin::LibraryUnloadException(
+					"Attempt to unload library that plugin_loader is unaware of.");
+			}
+			library = itr->second;
+			destroyMetaObjectsForLibrary(library_path, loader);
+
+			// Remove from loaded library list as well if no more factories associated with said library. The library
+			// lock keeps it from being loaded again before it is closed.
+			if (!areThereAnyExistingMetaObjectsForLibrary(library_path)) {
+				is_last_owner = true;
+				open_libraries.erase(itr);
+			}
+		}
+		// Readers that may still look at the factories of this library are waited for here, before dlclose and
+		// with no lock held
+		publishFactoryMapSnapshots();
+
+		if (!is_last_owner) {
+			logDebug(
+			  "plugin_loader.impl: "
+			  "MetaObjects still remain in memory meaning other PluginLoaders are still using library"
+			  ", keeping library %s open.",
+			  library_path.c_str());
+			return;
+		}
+		logDebug(
+		  "plugin_loader.impl: "
+		  "There are no more MetaObjects left for %s so unloading library and "
+		  "removing from loaded library vector.\n",
+		  library_path.c_str());
+		if (library != nullptr) {
 			try {
-				destroyMetaObjectsForLibrary(library_path, loader);
-
-				// Remove from loaded library list as well if no more factories associated with said library
-				if (!areThereAnyExistingMetaObjectsForLibrary(library_path)) {
-					 logDebug(
-					   "plugin_loader.impl: "
-					   "There are no more MetaObjects left for %s so unloading library and "
-					   "removing from loaded library vector.\n",
-					   library_path.c_str());
-
-					library->unload();
-					assert(library->isLoaded() == false);
-					delete (library);
-					library = nullptr;
-					itr = open_libraries.erase(itr);
-				}
-				else {
-					logDebug(
-					  "plugin_loader.impl: "
-					  "MetaObjects still remain in memory meaning other PluginLoaders are still using library"
-					  ", keeping library %s open.",
-					  library_path.c_str());
-				}
-				return;
+				library->unload();
+				assert(library->isLoaded() == false);
 			}
 			catch (const std::runtime_error & e) {
 				delete (library);
-				library = nullptr;
 				throw plugin::LibraryUnloadException(
 					"Could not unload library (exception = " + std::string(e.what()) + ")");
 			}
+			delete (library);
 		}
-		throw plugin::LibraryUnloadException(
-			"Attempt to unload library that plugin_loader is unaware of.");
 	}
 }
 
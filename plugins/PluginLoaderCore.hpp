@@ -32,16 +32,20 @@
 #ifndef PLUGIN_IMPL_CORE_HPP_
 #define PLUGIN_IMPL_CORE_HPP_
 
+#include <atomic>
 #include <mutex>
 #include <cstddef>
 #include <cstdio>
 #include <map>
+#include <memory>
 #include <string>
 #include <typeinfo>
 #include <utility>
 #include <vector>
 
 #include "MetaObject.hpp"
+#include "FlatHashMap.hpp"
+#include "RegistrySnapshot.hpp"
 #include "Console.h"
 #include "SharedLibrary.hpp"
 #include "PluginMacro.hpp"
@@ -60,8 +64,8 @@ namespace impl {
 typedef std::string LibraryPath;
 typedef std::string ClassName;
 typedef std::string BaseClassName;
-typedef std::map<ClassName, AbstractMetaObjectBase*> FactoryMap;
-typedef std::map<BaseClassName, FactoryMap> BaseToFactoryMapMap; // Todo : ̸ mapmap -> map
+typedef FlatHashMap<AbstractMetaObjectBase*> FactoryMap;
+typedef FlatHashMap<std::unique_ptr<FactoryMapSlot>> BaseToFactoryMapMap; // Todo : ̸ mapmap -> map
 typedef std::pair<LibraryPath, SharedLibrary*> LibraryPair;
 typedef std::vector<LibraryPair> LibraryVector;
 typedef std::vector<AbstractMetaObjectBase*> MetaObjectVector;
@@ -96,7 +100,7 @@ PLUGIN_LOADER_PUBLIC
 LibraryVector& getLoadedLibraryVector();
 
 /**
- * @brief Gets the PluginLoader currently in scope which used when a library is being loaded.
+ * @brief Gets the PluginLoader currently in scope which used when a library is being loaded by the calling thread.
  * @return A pointer to the currently active PluginLoader.
  *  Ƽ ÷ δ ptr ȯ.
  * inline Լ ŷ
@@ -105,7 +109,7 @@ PLUGIN_LOADER_PUBLIC
 PluginLoader* getCurrentlyActivePluginLoader();
 
 /**
- * @brief When a library is being loaded, in order for factories to know which library they are being associated with, they use this function to query which library is being loaded.
+ * @brief When a library is being loaded, in order for factories to know which library they are being associated with, they use this function to query which library is being loaded by the calling thread.
  * @return The currently set loading library name as a string
  *  ε ̺귯 ̸ ȯ.
  */
@@ -139,21 +143,67 @@ PluginLoader* getCurrentlyActivePluginLoader();
 
 /**
  * @brief This function extracts a reference to the FactoryMap for appropriate base class out of the global plugin base to factory map. This function should be used by functions in this namespace that need to access the various factories so as to make sure the right key is generated to index into the global map.
+ * FactoryMaps are created on first use and never destroyed, so the returned reference stays valid for the life of the process.
  * @return A reference to the FactoryMap contained within the global Base-to-FactoryMap map.
  */
 PLUGIN_LOADER_PUBLIC
 FactoryMap& getFactoryMapForBaseClass(const std::string & typeid_base_class_name);
 
+/**
+ * @brief Gets the registry slot (writable FactoryMap plus its published snapshot) for a base class. Like the FactoryMap, the slot lives for the life of the process.
+ * @return A reference to the FactoryMapSlot contained within the global Base-to-FactoryMap map.
+ */
+PLUGIN_LOADER_PUBLIC
+FactoryMapSlot& getFactoryMapSlotForBaseClass(const std::string & typeid_base_class_name);
+
 /**
  * @brief Same as above but uses a type parameter instead of string for more safety if info is available.
+ * @return A reference to the FactoryMapSlot contained within the global Base-to-FactoryMap map.
+ */
+template<typename Base>
+FactoryMapSlot& getFactoryMapSlotForBaseClass() {
+	// Resolved once per Base instead of hashing typeid(Base).name() on every call
+	static FactoryMapSlot& slot = getFactoryMapSlotForBaseClass(typeid(Base).name());
+	return slot;
+}
+
+/**
+ * @brief Same as getFactoryMapForBaseClass(const std::string&) but uses a type parameter instead of string for more safety if info is available.
  * @return A reference to the FactoryMap contained within the global Base-to-FactoryMap map.
  * Base ü class name ȯ.
  */
 template<typename Base>
 FactoryMap& getFactoryMapForBaseClass() {
-	return getFactoryMapForBaseClass(typeid(Base).name());
+	return getFactoryMapSlotForBaseClass<Base>().factories;
+}
+
+/**
+ * @brief Gets the slot for Base after publishing any registration that has not reached its snapshot yet. Call it before entering the RegistryReadGuard that reads the snapshot.
+ * @return A reference to the FactoryMapSlot for Base
+ */
+template<typename Base>
+FactoryMapSlot& getPublishedFactoryMapSlotForBaseClass() {
+	FactoryMapSlot& slot = getFactoryMapSlotForBaseClass<Base>();
+	if (slot.dirty.load(std::memory_order_acquire)) {
+		refreshFactoryMapSnapshots();
+	}
+	return slot;
 }
 
+/**
+ * @brief Inserts a MetaObject into the FactoryMap of a slot under its class name, keeping the per-library index in step and marking the slot for the next snapshot. All insertions into a FactoryMap must go through here.
+ * @param slot - The slot of the MetaObject's base class
+ * @param meta_obj - The MetaObject, with its library path and owners already set
+ */
+PLUGIN_LOADER_PUBLIC
+void insertMetaObjectIntoFactoryMap(FactoryMapSlot & slot, AbstractMetaObjectBase * meta_obj);
+
+/**
+ * @brief Indicates if inserting meta_obj into the FactoryMap of slot would overwrite the factory of another library for the same class. Replacing the factory of another generation of its own library (@see registerLibraryGeneration()) is not a collision. The registry mutex must be held.
+ */
+PLUGIN_LOADER_PUBLIC
+bool isNamespaceCollision(FactoryMapSlot & slot, AbstractMetaObjectBase * meta_obj);
+
 /**
  * @brief To provide thread safety, all exposed plugin functions can only be run serially by multiple threads. This is implemented by using critical sections enforced by a single mutex which is locked and released with the following two functions
  * @return A reference to the global mutex
@@ -198,21 +248,19 @@ void hasANonPurePluginLibraryBeenOpened(const bool hasIt);
  * @param Derived - parameteric type indicating concrete type of plugin
  * @param Base - parameteric type indicating base type of plugin
  * @param class_name - the literal name of the class being registered (NOT MANGLED)
+ * @param Meta - the MetaObject type to create, e.g. an ArgumentMetaObject for classes taking constructor arguments
  */
-template<typename Derived, typename Base>
+template<typename Derived, typename Base, typename Meta = MetaObject<Derived, Base>>
 void registerPlugin(std::string const& class_name, std::string const& base_class_name)
 {
 	// Note: This function will be automatically invoked when a dlopen() call
 	// opens a library. Normally it will happen within the scope of loadLibrary(),
 	// but that may not be guaranteed.
 	
-	char temp[512];
-	sprintf_s(temp, 512, "plugin.impl: "
+	logDebug("plugin.impl: "
 		"Registering plugin factory for class = %s, PluginLoader* = %p and library name %s.",
-		class_name.c_str(), getCurrentlyActivePluginLoader(),
+		class_name.c_str(), reinterpret_cast<void *>(getCurrentlyActivePluginLoader()),
 		getCurrentlyLoadingLibraryName().c_str());
-	std::string sss(temp);
- 	logDebug("%s", sss.c_str());
 
 	if (nullptr == getCurrentlyActivePluginLoader()) {
 		logDebug("%s",
@@ -235,15 +283,14 @@ void registerPlugin(std::string const& class_name, std::string const& base_class
 	}
 
 	// Create factory
-	AbstractMetaObjectBase* new_factory = new MetaObject<Derived, Base>(class_name, base_class_name);
+	AbstractMetaObjectBase* new_factory = new Meta(class_name, base_class_name);
 	new_factory->addOwningPluginLoader(getCurrentlyActivePluginLoader());
 	new_factory->setAssociatedLibraryPath(getCurrentlyLoadingLibraryName());
 
 
 	// Add it to global factory map map
 	getPluginBaseToFactoryMapMapMutex().lock();
-	FactoryMap& factoryMap = getFactoryMapForBaseClass<Base>();
-	if (factoryMap.find(class_name) != factoryMap.end()) {
+	if (isNamespaceCollision(getFactoryMapSlotForBaseClass<Base>(), new_factory)) {
 		logWarn(
 		  "plugin_loader.impl: SEVERE WARNING!!! "
 		  "A namespace collision has occured with plugin factory for class %s. "
@@ -254,7 +301,8 @@ void registerPlugin(std::string const& class_name, std::string const& base_class
 		  "and use either plugin_loader::PluginLoader/MultiLibraryPluginLoader to open.",
 		  class_name.c_str());
 	}
-	factoryMap[class_name] = new_factory;
+	// Readers pick it up with the next snapshot, published by loadLibrary() or lazily on first use
+	insertMetaObjectIntoFactoryMap(getFactoryMapSlotForBaseClass<Base>(), new_factory);
 	getPluginBaseToFactoryMapMapMutex().unlock();
 
 	logDebug(
@@ -264,52 +312,69 @@ void registerPlugin(std::string const& class_name, std::string const& base_class
 }
 
 /**
- * @brief This function creates an instance of a plugin class given the derived name of the class and returns a pointer of the Base class type.
+ * @brief Looks up the factory createInstance() would use, in a snapshot the caller keeps alive with a RegistryReadGuard.
+ * @param snapshot - The published snapshot of the FactoryMap for Base, may be nullptr
  * @param derived_class_name - The name of the derived class (unmangled)
  * @param loader - The PluginLoader whose scope we are within
- * @return A pointer to newly created plugin, note caller is responsible for object destruction
+ * @return The factory, owned by loader or by nobody. Throws CreateClassException if there is none.
  */
 template<typename Base>
-Base* createInstance(const std::string& derived_class_name, PluginLoader* loader)
+AbstractMetaObject<Base>* findFactory(
+	const FactorySnapshot * snapshot, const std::string& derived_class_name, PluginLoader* loader)
 {
 	AbstractMetaObject<Base>* factory = nullptr;
+	const FactorySnapshotEntry* entry = nullptr;
 
-	getPluginBaseToFactoryMapMapMutex().lock();
-	FactoryMap & factoryMap = getFactoryMapForBaseClass<Base>();
-	if (factoryMap.find(derived_class_name) != factoryMap.end()) {
-		factory = dynamic_cast<AbstractMetaObject<Base> *>(factoryMap[derived_class_name]);
+	if (snapshot != nullptr) {
+		auto itr = snapshot->factories.find(derived_class_name);
+		if (itr != snapshot->factories.end()) {
+			entry = &itr->second;
+			factory = dynamic_cast<AbstractMetaObject<Base> *>(entry->factory);
+		}
 	}
-	else {
+	if (nullptr == entry) {
 		logError(
 		  "plugin_loader.impl: No metaobject exists for class type %s.", derived_class_name.c_str());
 	}
-	getPluginBaseToFactoryMapMapMutex().unlock();
 
-	Base * obj = nullptr;
-	if (factory != nullptr && factory->isOwnedBy(loader)) {
-		obj = factory->create();
+	if (factory != nullptr && entry->isOwnedBy(loader)) {
+		return factory;
 	}
+	if (factory && entry->isOwnedBy(nullptr)) {
+		logDebug("%s",
+		    "plugin_loader.impl: ALERT!!! "
+		    "A metaobject (i.e. factory) exists for desired class, but has no owner. "
+		    "This implies that the library containing the class was dlopen()ed by means other than "
+		    "through the plugin_loader interface. "
+		    "This can happen if you build plugin libraries that contain more than just plugins "
+		    "(i.e. normal code your app links against) -- that intrinsically will trigger a dlopen() "
+		    "prior to main(). "
+		    "You should isolate your plugins into their own library, otherwise it will not be "
+		    "possible to shutdown the library!");
+		return factory;
+	}
+	throw plugin::CreateClassException(
+		"Could not create instance of type " + derived_class_name);
+}
 
-	if (nullptr == obj) {  // Was never created
-		if (factory && factory->isOwnedBy(nullptr)) {
-			logDebug("%s",
-			    "plugin_loader.impl: ALERT!!! "
-			    "A metaobject (i.e. factory) exists for desired class, but has no owner. "
-			    "This implies that the library containing the class was dlopen()ed by means other than "
-			    "through the plugin_loader interface. "
-			    "This can happen if you build plugin libraries that contain more than just plugins "
-			    "(i.e. normal code your app links against) -- that intrinsically will trigger a dlopen() "
-			    "prior to main(). "
-			    "You should isolate your plugins into their own library, otherwise it will not be "
-			    "possible to shutdown the library!");
-
-			obj = factory->create();
-		}
-		else {
-			throw plugin::CreateClassException(
-				"Could not create instance of type " + derived_class_name);
-		}
+/**
+ * @brief This function creates an instance of a plugin class given the derived name of the class and returns a pointer of the Base class type.
+ * @param derived_class_name - The name of the derived class (unmangled)
+ * @param loader - The PluginLoader whose scope we are within
+ * @param construct - Callable turning the resolved const AbstractMetaObject<Base>& into a Base*, e.g. by calling create() or by constructing into storage of its own
+ * @return A pointer to newly created plugin, note caller is responsible for object destruction
+ * The lookup runs on the published snapshot without taking the registry mutex. The factory is invoked after the read section, since plugin code may load libraries or create other plugins and writers wait for read sections: the caller must keep the library loaded meanwhile, e.g. with a plugin reference (@see PluginLoader::createRawInstance()).
+ */
+template<typename Base, typename Construct>
+Base* createInstance(const std::string& derived_class_name, PluginLoader* loader, Construct && construct)
+{
+	FactoryMapSlot & slot = getPublishedFactoryMapSlotForBaseClass<Base>();
+	AbstractMetaObject<Base>* factory = nullptr;
+	{
+		RegistryReadGuard guard;
+		factory = findFactory<Base>(slot.snapshot.load(std::memory_order_acquire), derived_class_name, loader);
 	}
+	Base * obj = construct(*factory);
 
 	logDebug(
 	    "plugin_loader.impl: Created instance of type %s and object pointer = %p",
@@ -318,34 +383,80 @@ Base* createInstance(const std::string& derived_class_name, PluginLoader* loader
 	return obj;
 }
 
-
 /**
- * @brief This function returns all the available plugin_loader in the plugin system that are derived from Base and within scope of the passed PluginLoader.
- * @param loader - The pointer to the PluginLoader whose scope we are within,
- * @return A vector of strings where each string is a plugin we can create
+ * @brief Same as createInstance() above with the object allocated by the factory's create()
  */
 template<typename Base>
-std::vector<std::string> getAvailableClasses(PluginLoader * loader)
+Base* createInstance(const std::string& derived_class_name, PluginLoader* loader)
 {
-	std::unique_lock<std::recursive_mutex> lock(getPluginBaseToFactoryMapMapMutex());
+	return createInstance<Base>(derived_class_name, loader,
+		[](const AbstractMetaObject<Base> & factory) {return factory.create();});
+}
 
-	FactoryMap & factory_map = getFactoryMapForBaseClass<Base>();
-	std::vector<std::string> classes;
-	std::vector<std::string> classes_with_no_owner;
 
-	for (auto & it : factory_map) {
-		AbstractMetaObjectBase * factory = it.second;
-		if (factory->isOwnedBy(loader)) {
-			classes.push_back(it.first);
+/**
+ * @brief Visits the same classes as getAvailableClasses(), in the same order, without copying any name.
+ * The visitor runs inside a registry read section: the views are only valid during the call, and it must not load or unload libraries.
+ * @param loader - The pointer to the PluginLoader whose scope we are within
+ * @param visit - Callable taking a std::string_view class name
+ */
+template<typename Base, typename Visitor>
+void forEachAvailableClass(PluginLoader * loader, Visitor && visit)
+{
+	FactoryMapSlot & slot = getPublishedFactoryMapSlotForBaseClass<Base>();
+	RegistryReadGuard guard;
+	const FactorySnapshot * snapshot = slot.snapshot.load(std::memory_order_acquire);
+	if (nullptr == snapshot) {
+		return;
+	}
+
+	for (auto & it : snapshot->factories) {
+		if (it.second.isOwnedBy(loader)) {
+			visit(std::string_view(it.first));
 		}
-		else if (factory->isOwnedBy(nullptr)) {
-			classes_with_no_owner.push_back(it.first);
+	}
+	// Classes not associated with a class loader (Which can happen through
+	// an unexpected dlopen() to the library) come last
+	if (loader != nullptr) {
+		for (auto & it : snapshot->factories) {
+			if (it.second.isOwnedBy(nullptr)) {
+				visit(std::string_view(it.first));
+			}
 		}
 	}
+}
+
+/**
+ * @brief Indicates if a class is among getAvailableClasses() with a single hash probe, without allocating.
+ * @param class_name - The name of the derived class (unmangled)
+ * @param loader - The pointer to the PluginLoader whose scope we are within
+ */
+template<typename Base>
+bool isClassAvailable(std::string_view class_name, PluginLoader * loader)
+{
+	FactoryMapSlot & slot = getPublishedFactoryMapSlotForBaseClass<Base>();
+	RegistryReadGuard guard;
+	const FactorySnapshot * snapshot = slot.snapshot.load(std::memory_order_acquire);
+	if (nullptr == snapshot) {
+		return false;
+	}
+	auto itr = snapshot->factories.find(class_name);
+	return itr != snapshot->factories.end() &&
+		(itr->second.isOwnedBy(loader) || itr->second.isOwnedBy(nullptr));
+}
 
-	// Added classes not associated with a class loader (Which can happen through
-	// an unexpected dlopen() to the library)
-	classes.insert(classes.end(), classes_with_no_owner.begin(), classes_with_no_owner.end());
+/**
+ * @brief This function returns all the available plugin_loader in the plugin system that are derived from Base and within scope of the passed PluginLoader.
+ * @param loader - The pointer to the PluginLoader whose scope we are within,
+ * @return A vector of strings where each string is a plugin we can create
+ */
+template<typename Base>
+std::vector<std::string> getAvailableClasses(PluginLoader * loader)
+{
+	std::vector<std::string> classes;
+	forEachAvailableClass<Base>(loader, [&classes](std::string_view class_name) {
+		classes.emplace_back(class_name);
+	});
 	return classes;
 }
 
@@ -357,6 +468,27 @@ std::vector<std::string> getAvailableClasses(PluginLoader * loader)
 PLUGIN_LOADER_PUBLIC
 std::vector<std::string> getAllLibrariesUsedByPluginLoader(const PluginLoader * loader);
 
+/**
+ * @brief Gets the MetaObjects of all FactoryMaps, not those of the graveyard. The registry mutex must be held while they are used.
+ */
+PLUGIN_LOADER_PUBLIC
+MetaObjectVector allMetaObjects();
+
+/**
+ * @brief Gets the MetaObjects registered for a library, whatever their owners. They stay valid as long as the library stays loaded.
+ * @param library_path - The path of the library
+ */
+PLUGIN_LOADER_PUBLIC
+MetaObjectVector allMetaObjectsForLibrary(const std::string & library_path);
+
+/**
+ * @brief Same as allMetaObjectsForLibrary() but only those owned by a PluginLoader
+ * @param library_path - The path of the library
+ * @param owner - The PluginLoader
+ */
+PLUGIN_LOADER_PUBLIC
+MetaObjectVector allMetaObjectsForLibraryOwnedBy(const std::string & library_path, const PluginLoader * owner);
+
 /**
  * @brief Indicates if passed library loaded within scope of a PluginLoader. The library maybe loaded in memory, but to the class loader it may not be.
  * @param library_path - The name of the library we wish to check is open
@@ -378,9 +510,11 @@ bool isLibraryLoadedByAnybody(const std::string & library_path);
  * @brief Loads a library into memory if it has not already been done so. Attempting to load an already loaded library has no effect.
  * @param library_path - The name of the library to open
  * @param loader - The pointer to the PluginLoader whose scope we are within
+ * @param options - Binding/visibility flags handed to the platform loader when the library is actually opened
  */
 PLUGIN_LOADER_PUBLIC
-void loadLibrary(const std::string & library_path, PluginLoader* loader);
+void loadLibrary(const std::string & library_path, PluginLoader* loader,
+	const SharedLibrary::LoadOptions & options = SharedLibrary::LoadOptions());
 
 /**
  * @brief Unloads a library if it loaded in memory and cleans up its corresponding class factories. If it is not loaded, the function has no effect
@@ -390,6 +524,35 @@ void loadLibrary(const std::string & library_path, PluginLoader* loader);
 PLUGIN_LOADER_PUBLIC
 void unloadLibrary(const std::string & library_path, PluginLoader* loader);
 
+/**
+ * @brief Registers a library that is linked into the executable instead of opened (@see registerStaticPlugins()). loadLibrary() and unloadLibrary() then bind and unbind its MetaObjects without opening or closing anything.
+ * @param library_path - The name loaders use for the library
+ * @param meta_objects - Its MetaObjects, owned by the registry from now on. They are destroyed if the registration fails.
+ * @throws LibraryLoadException if library_path is already registered or loaded
+ */
+PLUGIN_LOADER_PUBLIC
+void registerStaticLibrary(const std::string & library_path, const MetaObjectVector & meta_objects);
+
+/**
+ * @brief Indicates if library_path was registered with registerStaticLibrary()
+ */
+PLUGIN_LOADER_PUBLIC
+bool isStaticLibrary(const std::string & library_path);
+
+/**
+ * @brief Declares image_path a generation of library_path, i.e. a copy of it opened to reload it. When it is loaded, its factories replace those of the other generations of library_path without a collision warning. The replaced MetaObjects are retired: they stay bound to the loaders of their generation and are destroyed when it is unloaded, instead of going to the graveyard.
+ * @param image_path - The path the copy is opened from
+ * @param library_path - The path of the original library
+ */
+PLUGIN_LOADER_PUBLIC
+void registerLibraryGeneration(const std::string & image_path, const std::string & library_path);
+
+/**
+ * @brief Forgets a generation declared with registerLibraryGeneration(), once it is unloaded
+ */
+PLUGIN_LOADER_PUBLIC
+void unregisterLibraryGeneration(const std::string & image_path);
+
 
 ////////////////////////////////////////////////////////////////////////// 
 // inline 
@@ -431,24 +594,26 @@ LibraryVector& getLoadedLibraryVector()
 	return instance;
 }
 
+// The loading context is per thread: static initializers run on the thread that opens their library, so
+// libraries opened concurrently by different threads each see their own loader and name.
 PLUGIN_LOADER_PUBLIC inline
 std::string& getCurrentlyLoadingLibraryNameReference()
 {
-	static std::string library_name;
+	thread_local std::string library_name;
 	return library_name;
 }
 
 PLUGIN_LOADER_PUBLIC inline
-bool& hasANonPurePluginLibraryBeenOpenedReference()
+std::atomic<bool>& hasANonPurePluginLibraryBeenOpenedReference()
 {
-	static bool hasANonPurePluginLibraryBeenOpenedReference = false;
+	static std::atomic<bool> hasANonPurePluginLibraryBeenOpenedReference(false);
 	return hasANonPurePluginLibraryBeenOpenedReference;
 }
 
 PLUGIN_LOADER_PUBLIC inline
 PluginLoader*& getCurrentlyActivePluginLoaderReference()
 {
-	static PluginLoader* loader = nullptr;
+	thread_local PluginLoader* loader = nullptr;
 	return loader;
 }
 
@@ -2,16 +2,98 @@
 #ifndef PLUGIN_MACRO_HPP_
 #define PLUGIN_MACRO_HPP_
 
+#include <cstddef>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include "LibraryDescriptor.hpp"
 #include "PluginLoaderCore.hpp"
+#include "VisibilityControl.h"
+
+/**
+ * Class record embedded by the registration macros in the PLUGIN_LOADER_CLASSES_SECTION section of ELF libraries:
+ * "PLUGIN_LOADER_CLASS_RECORD_TAG <tab> Base <tab> Derived <tab> canonical Base", NUL terminated, Base being spelled
+ * as in the macro and the canonical Base as the compiler names the type: fully qualified, aliases resolved.
+ * PluginManifest::readEmbedded() lists the classes of a library from these records without loading it. Nothing is
+ * embedded on other platforms.
+ */
+#if defined(__ELF__)
+#if defined(__has_attribute)
+#if __has_attribute(retain)
+#define PLUGIN_LOADER_CLASS_RECORD_RETAIN __attribute__((retain))
+#endif
+#endif
+#ifndef PLUGIN_LOADER_CLASS_RECORD_RETAIN
+#define PLUGIN_LOADER_CLASS_RECORD_RETAIN
+#endif
+
+namespace plugin
+{
+namespace impl
+{
+
+/**
+ * @brief Gets the name of T the way the compiler prints it in __PRETTY_FUNCTION__, e.g. "zoo::Keeper" for an alias of
+ * it or for Keeper named through a using declaration
+ */
+template<typename T>
+constexpr std::string_view getCanonicalTypeName()
+{
+  constexpr std::string_view function = __PRETTY_FUNCTION__;
+  // "... [with T = zoo::Keeper; ...]" from GCC, "... [T = zoo::Keeper]" from Clang
+  constexpr std::size_t begin = function.find("T = ") + 4;
+  return function.substr(begin, function.find_first_of(";]", begin) - begin);
+}
+
+template<std::size_t Size>
+struct ClassRecord
+{
+  char text[Size];
+};
+
+/**
+ * @brief Appends a tab and the canonical name of Base to a class record
+ * @param prefix - "PLUGIN_LOADER_CLASS_RECORD_TAG <tab> Base <tab> Derived"
+ */
+template<typename Base, std::size_t PrefixSize>
+constexpr ClassRecord<PrefixSize + getCanonicalTypeName<Base>().size() + 1>
+makeClassRecord(const char (&prefix)[PrefixSize])
+{
+  constexpr std::string_view base = getCanonicalTypeName<Base>();
+  ClassRecord<PrefixSize + base.size() + 1> record{};
+  std::size_t size = 0;
+  for (std::size_t i = 0; i + 1 < PrefixSize; ++i) {
+    record.text[size++] = prefix[i];
+  }
+  record.text[size++] = '\t';
+  for (char c : base) {
+    record.text[size++] = c;
+  }
+  return record;
+}
+
+}  // namespace impl
+}  // namespace plugin
+
+#define PLUGIN_LOADER_CLASS_RECORD(Derived, Base, UniqueID) \
+  static constexpr auto g_plugin_class_record_ ## UniqueID \
+  __attribute__((section(PLUGIN_LOADER_CLASSES_SECTION), used)) PLUGIN_LOADER_CLASS_RECORD_RETAIN = \
+    ::plugin::impl::makeClassRecord<Base>(PLUGIN_LOADER_CLASS_RECORD_TAG "\t" #Base "\t" #Derived);
+#else
+#define PLUGIN_LOADER_CLASS_RECORD(Derived, Base, UniqueID)
+#endif
 
 #define PLUGIN_LOADER_REGISTER_CLASS_INTERNAL(Derived, Base, UniqueID) \
   namespace \
   { \
+  PLUGIN_LOADER_CLASS_RECORD(Derived, Base, UniqueID) \
   struct ProxyExec ## UniqueID \
   { \
     typedef  Derived _derived; \
     typedef  Base _base; \
+    static_assert(std::is_default_constructible<_derived>::value, \
+      #Derived " is not default constructible, register it with PLUGIN_LOADER_REGISTER_CLASS_WITH_ARGS or " \
+      "PLUGIN_LOADER_REGISTER_FACTORY"); \
     ProxyExec ## UniqueID() \
     { \
       plugin::impl::registerPlugin<_derived, _base>(#Derived, #Base); \
@@ -26,5 +108,64 @@
 #define PLUGIN_LOADER_REGISTER_CLASS(Derived, Base) \
   PLUGIN_LOADER_REGISTER_CLASS_INTERNAL_HOP1(Derived, Base, __COUNTER__)
 
+#define PLUGIN_LOADER_REGISTER_ARGUMENT_CLASS_INTERNAL(Derived, Base, UniqueID, ...) \
+  namespace \
+  { \
+  PLUGIN_LOADER_CLASS_RECORD(Derived, Base, UniqueID) \
+  struct ProxyExec ## UniqueID \
+  { \
+    typedef  Derived _derived; \
+    typedef  Base _base; \
+    typedef  __VA_ARGS__ _arguments; \
+    ProxyExec ## UniqueID() \
+    { \
+      plugin::impl::registerPlugin<_derived, _base, \
+        plugin::ArgumentMetaObject<_derived, _base, _arguments>>(#Derived, #Base); \
+    } \
+  }; \
+  static ProxyExec ## UniqueID g_register_plugin_ ## UniqueID; \
+  }  // namespace
+
+#define PLUGIN_LOADER_REGISTER_ARGUMENT_CLASS_INTERNAL_HOP1(Derived, Base, UniqueID, ...) \
+  PLUGIN_LOADER_REGISTER_ARGUMENT_CLASS_INTERNAL(Derived, Base, UniqueID, __VA_ARGS__)
+
+/**
+ * Registers a class created with constructor arguments, e.g.
+ * PLUGIN_LOADER_REGISTER_CLASS_WITH_ARGS(Filter, Base, std::string, int) for Filter(std::string, int).
+ * Create it with PluginLoader::createSharedInstance<Base>(name, std::string(...), 3) and friends.
+ */
+#define PLUGIN_LOADER_REGISTER_CLASS_WITH_ARGS(Derived, Base, ...) \
+  PLUGIN_LOADER_REGISTER_ARGUMENT_CLASS_INTERNAL_HOP1(Derived, Base, __COUNTER__, \
+    plugin::ConstructorArguments<Derived, Base, __VA_ARGS__>)
+
+/**
+ * Registers a class created by a factory function returning it by value, e.g. Filter makeFilter(std::string).
+ * The function's parameters become the constructor arguments, as with PLUGIN_LOADER_REGISTER_CLASS_WITH_ARGS.
+ */
+#define PLUGIN_LOADER_REGISTER_FACTORY(Derived, Base, Function) \
+  PLUGIN_LOADER_REGISTER_ARGUMENT_CLASS_INTERNAL_HOP1(Derived, Base, __COUNTER__, \
+    plugin::FunctionArguments<Derived, Base, decltype(&Function), &Function>)
+
+/**
+ * Entry of PLUGIN_LOADER_REGISTER_LIBRARY for Derived, default constructed like with PLUGIN_LOADER_REGISTER_CLASS
+ */
+#define PLUGIN_LOADER_LIBRARY_CLASS(Derived, Base) \
+  plugin::makePluginDescriptor<Derived, Base>(#Derived, #Base)
+
+/**
+ * Registers every class of a library with one exported table instead of one static initializer per class, e.g.
+ * PLUGIN_LOADER_REGISTER_LIBRARY(PLUGIN_LOADER_LIBRARY_CLASS(Dog, Base), PLUGIN_LOADER_LIBRARY_CLASS(Cat, Base))
+ * Use it once per library, in place of PLUGIN_LOADER_REGISTER_CLASS. Nothing runs when the library is opened; the
+ * loader reads the table afterwards and registers all classes under one lock.
+ */
+#define PLUGIN_LOADER_REGISTER_LIBRARY(...) \
+  namespace \
+  { \
+  constexpr plugin::PluginDescriptor plugin_loader_library_classes[] = {__VA_ARGS__}; \
+  }  /* namespace */ \
+  extern "C" PLUGIN_LOADER_EXPORT const plugin::LibraryDescriptor plugin_loader_library_descriptor = { \
+    PLUGIN_LOADER_LIBRARY_DESCRIPTOR_VERSION, \
+    sizeof(plugin_loader_library_classes) / sizeof(plugin_loader_library_classes[0]), \
+    plugin_loader_library_classes};
 
-#endif // PLUGIN_MACRO_HPP_
\ No newline at end of file
+#endif // PLUGIN_MACRO_HPP_
@@ -0,0 +1,241 @@
+#include "PluginManifest.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <tuple>
+
+#include "ElfImage.hpp"
+#include "Exceptions.hpp"
+#include "LibraryDescriptor.hpp"
+#include "PluginLoader.hpp"
+#include "PluginLoaderCore.hpp"
+
+namespace plugin
+{
+
+namespace
+{
+
+const char * const MANIFEST_HEADER = "plugin_loader_manifest";
+const unsigned MANIFEST_VERSION = 1;
+
+bool isBefore(const PluginManifest::Entry & a, const PluginManifest::Entry & b)
+{
+	return std::tie(a.typeid_base_class_name, a.class_name) < std::tie(b.typeid_base_class_name, b.class_name);
+}
+
+std::vector<PluginManifest::Entry> getEntries(const impl::MetaObjectVector & meta_objects)
+{
+	std::vector<PluginManifest::Entry> entries;
+	entries.reserve(meta_objects.size());
+	for (auto & meta_obj : meta_objects) {
+		entries.push_back(PluginManifest::Entry{
+			meta_obj->typeidBaseClassName(), meta_obj->baseClassName(), meta_obj->className()});
+	}
+	std::sort(entries.begin(), entries.end(), isBefore);
+	return entries;
+}
+
+/**
+ * Gets typeid(T).name() of the class T named base_class_name, mangled as the Itanium C++ ABI does, or an empty
+ * string if it is not a plain class name qualified from the global namespace (templates, anonymous namespaces...) or
+ * the compiler follows another ABI. Only the canonical names of class records (@see PLUGIN_LOADER_CLASS_RECORD) are
+ * qualified that way: any name a user spelled may be an alias, or relative to a using directive.
+ */
+std::string getTypeidName(const std::string & base_class_name)
+{
+#if defined(__GXX_ABI_VERSION)
+	std::vector<std::string> names;
+	std::string::size_type begin = base_class_name.compare(0, 2, "::") == 0 ? 2 : 0;
+	while (true) {
+		const std::string::size_type end = base_class_name.find("::", begin);
+		std::string name = base_class_name.substr(begin, end - begin);
+		if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0])) ||
+			std::any_of(name.begin(), name.end(), [](char c) {
+				return !std::isalnum(static_cast<unsigned char>(c)) && c != '_';
+			}))
+		{
+			return std::string();
+		}
+		names.push_back(std::move(name));
+		if (std::string::npos == end) {
+			break;
+		}
+		begin = end + 2;
+	}
+
+	// std:: has its own abbreviation: std::X is "St1X", std::X::Y is "NSt1X1YE"
+	const bool in_std = names.size() > 1 && names.front() == "std";
+	const std::size_t first = in_std ? 1 : 0;
+	const bool nested = names.size() - first > 1;
+	std::string mangled = nested ? "N" : "";
+	if (in_std) {
+		mangled += "St";
+	}
+	for (std::size_t i = first; i < names.size(); ++i) {
+		mangled += std::to_string(names[i].size()) + names[i];
+	}
+	if (nested) {
+		mangled += 'E';
+	}
+	return mangled;
+#else
+	return std::string();
+#endif
+}
+
+} // namespace
+
+PluginManifest::PluginManifest()
+	: library_hash_(0), embedded_(false)
+{
+}
+
+PluginManifest PluginManifest::generate(const std::string & library_path)
+{
+	PluginLoader loader(library_path, false);
+	PluginManifest manifest;
+	manifest.library_hash_ = hashFile(library_path);
+	manifest.classes_ = getEntries(impl::allMetaObjectsForLibraryOwnedBy(library_path, &loader));
+	return manifest;
+}
+
+std::uint64_t PluginManifest::hashFile(const std::string & path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		throw plugin::LibraryLoadException("Could not read library " + path);
+	}
+	std::uint64_t hash = 14695981039346656037ULL;
+	char buffer[65536];
+	while (file) {
+		file.read(buffer, sizeof(buffer));
+		for (std::streamsize i = 0; i < file.gcount(); ++i) {
+			hash ^= static_cast<unsigned char>(buffer[i]);
+			hash *= 1099511628211ULL;
+		}
+	}
+	return hash;
+}
+
+bool PluginManifest::read(const std::string & manifest_path)
+{
+	library_hash_ = 0;
+	embedded_ = false;
+	classes_.clear();
+
+	std::ifstream file(manifest_path);
+	std::string header;
+	unsigned version = 0;
+	std::string hash_key;
+	if (!(file >> header >> version >> hash_key >> std::hex >> library_hash_) ||
+		header != MANIFEST_HEADER || version != MANIFEST_VERSION || hash_key != "library_hash")
+	{
+		library_hash_ = 0;
+		return false;
+	}
+
+	std::string line;
+	std::getline(file, line);
+	while (std::getline(file, line)) {
+		if (line.empty()) {
+			continue;
+		}
+		std::istringstream fields(line);
+		std::string key;
+		Entry entry;
+		if (!std::getline(fields, key, '\t') || key != "class" ||
+			!std::getline(fields, entry.typeid_base_class_name, '\t') ||
+			!std::getline(fields, entry.base_class_name, '\t') ||
+			!std::getline(fields, entry.class_name))
+		{
+			library_hash_ = 0;
+			classes_.clear();
+			return false;
+		}
+		classes_.push_back(entry);
+	}
+	return true;
+}
+
+bool PluginManifest::readEmbedded(const std::string & library_path)
+{
+	library_hash_ = 0;
+	embedded_ = false;
+	classes_.clear();
+
+	const impl::ElfImage image(library_path);
+	std::string_view section = image.findSection(PLUGIN_LOADER_CLASSES_SECTION);
+	if (section.empty()) {
+		return false;
+	}
+
+	// NUL terminated records, possibly separated by padding NULs when the compiler over-aligns the arrays
+	const std::string_view tag = PLUGIN_LOADER_CLASS_RECORD_TAG "\t";
+	while (!section.empty()) {
+		const std::string_view record = section.substr(0, section.find('\0'));
+		section.remove_prefix(std::min(section.size(), record.size() + 1));
+		if (record.empty()) {
+			continue;
+		}
+		const std::string_view::size_type separator = record.find('\t', tag.size());
+		const std::string_view::size_type canonical_separator =
+			std::string_view::npos == separator ? separator : record.find('\t', separator + 1);
+		if (record.substr(0, tag.size()) != tag || std::string_view::npos == canonical_separator) {
+			classes_.clear();
+			return false;
+		}
+		Entry entry;
+		entry.base_class_name = std::string(record.substr(tag.size(), separator - tag.size()));
+		entry.class_name = std::string(record.substr(separator + 1, canonical_separator - separator - 1));
+		entry.typeid_base_class_name = getTypeidName(std::string(record.substr(canonical_separator + 1)));
+		if (entry.typeid_base_class_name.empty()) {
+			classes_.clear();
+			return false;
+		}
+		classes_.push_back(std::move(entry));
+	}
+	std::sort(classes_.begin(), classes_.end(), isBefore);
+	embedded_ = !classes_.empty();
+	return embedded_;
+}
+
+void PluginManifest::write(const std::string & manifest_path) const
+{
+	std::ofstream file(manifest_path, std::ios::trunc);
+	file << MANIFEST_HEADER << ' ' << MANIFEST_VERSION << '\n';
+	file << "library_hash " << std::hex << library_hash_ << std::dec << '\n';
+	for (const Entry & entry : classes_) {
+		file << "class\t" << entry.typeid_base_class_name << '\t' << entry.base_class_name << '\t' <<
+			entry.class_name << '\n';
+	}
+	file.close();
+	if (!file) {
+		throw plugin::PluginLoaderException("Could not write plugin manifest " + manifest_path);
+	}
+}
+
+bool PluginManifest::verify(const std::string & library_path) const
+{
+	try {
+		if (!embedded_ && hashFile(library_path) != library_hash_) {
+			return false;
+		}
+	}
+	catch (const plugin::LibraryLoadException &) {
+		return false;
+	}
+
+	std::vector<Entry> registered = getEntries(impl::allMetaObjectsForLibrary(library_path));
+	std::vector<Entry> listed = classes_;
+	std::sort(listed.begin(), listed.end(), isBefore);
+	return registered.size() == listed.size() &&
+		std::equal(registered.begin(), registered.end(), listed.begin(),
+			[](const Entry & a, const Entry & b) {
+				return a.typeid_base_class_name == b.typeid_base_class_name && a.class_name == b.class_name;
+			});
+}
+
+} // namespace plugin
@@ -0,0 +1,136 @@
+#ifndef PLUGIN_PLUGIN_MANIFEST_HPP_
+#define PLUGIN_PLUGIN_MANIFEST_HPP_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "VisibilityControl.h"
+
+namespace plugin {
+
+/**
+ * @class PluginManifest
+ * @brief List of the classes of a plugin library, written next to it at build time so they can be discovered
+ * without opening it.
+ *
+ * The build step (the PluginLoader_manifest tool, @see plugin_loader_generate_manifest() in CMake) loads the library
+ * once and records every class with its base and a hash of the library file. A PluginLoader that read the manifest
+ * (@see PluginLoader::loadManifest()) answers class queries from it until the library is actually loaded, and then
+ * checks both the hash and the classes against what the library registered.
+ *
+ * The file is text: a "plugin_loader_manifest <version>" line, a "library_hash <hex>" line, then one
+ * "class <typeid(Base).name()> <base class name> <class name>" line per class, fields separated by tabs.
+ *
+ * A manifest can also be read from the library itself (@see readEmbedded()): the registration macros embed a record
+ * per class in an ELF section, so it cannot drift from the library and needs no hash.
+ */
+class PluginManifest
+{
+public:
+  struct Entry
+  {
+    std::string typeid_base_class_name;
+    std::string base_class_name;
+    std::string class_name;
+  };
+
+  PLUGIN_LOADER_PUBLIC
+  PluginManifest();
+
+  /**
+   * @brief Gets where the manifest of a library is expected: next to it, with ".manifest" appended
+   */
+  static std::string getManifestPath(const std::string & library_path) {return library_path + ".manifest";}
+
+  /**
+   * @brief Builds the manifest of a library by loading it. Meant for the build step, not for applications.
+   * @throws LibraryLoadException if the library cannot be loaded or read
+   */
+  PLUGIN_LOADER_PUBLIC
+  static PluginManifest generate(const std::string & library_path);
+
+  /**
+   * @brief Hashes the content of a file (64 bit FNV-1a)
+   * @throws LibraryLoadException if it cannot be read
+   */
+  PLUGIN_LOADER_PUBLIC
+  static std::uint64_t hashFile(const std::string & path);
+
+  /**
+   * @brief Replaces the content of this manifest with the one of a file
+   * @return false if the file is missing or malformed, in which case this manifest is left empty
+   */
+  PLUGIN_LOADER_PUBLIC
+  bool read(const std::string & manifest_path);
+
+  /**
+   * @brief Replaces the content of this manifest with the class records embedded in a library by
+   * PLUGIN_LOADER_REGISTER_CLASS and friends. The file is mapped read-only and only its section headers and the
+   * PLUGIN_LOADER_CLASSES_SECTION section are touched: no code runs and nothing is relocated, so it is cheap enough
+   * to scan whole plugin directories. Classes registered with PLUGIN_LOADER_REGISTER_LIBRARY are not embedded.
+   * Only ELF libraries built with an Itanium C++ ABI compiler are supported, and base classes must not be templates
+   * nor in an anonymous namespace, since typeid(Base).name() is derived from their fully qualified name, which the
+   * records carry whatever the spelling used in the macro.
+   * @return false if the library cannot be read, is not ELF, has no class records or a record it cannot use, in which
+   * case this manifest is left empty
+   */
+  PLUGIN_LOADER_PUBLIC
+  bool readEmbedded(const std::string & library_path);
+
+  /**
+   * @brief Writes this manifest to a file
+   * @throws PluginLoaderException if it cannot be written
+   */
+  PLUGIN_LOADER_PUBLIC
+  void write(const std::string & manifest_path) const;
+
+  /**
+   * @brief Checks this manifest against a loaded library: same file hash and same classes as the library
+   * registered, in any order. The hash is not checked for embedded manifests.
+   */
+  PLUGIN_LOADER_PUBLIC
+  bool verify(const std::string & library_path) const;
+
+  std::uint64_t getLibraryHash() const {return library_hash_;}
+  bool isEmbedded() const {return embedded_;}
+  const std::vector<Entry> & getClasses() const {return classes_;}
+
+  /**
+   * @brief Visits the names of the classes derived from a base
+   * @param typeid_base_class_name - typeid(Base).name()
+   * @param visit - Callable taking a std::string_view
+   */
+  template<class Visitor>
+  void forEachClass(std::string_view typeid_base_class_name, Visitor && visit) const
+  {
+    for (const Entry & entry : classes_) {
+      if (entry.typeid_base_class_name == typeid_base_class_name) {
+        visit(std::string_view(entry.class_name));
+      }
+    }
+  }
+
+  /**
+   * @brief Indicates if the manifest lists a class derived from a base
+   */
+  bool hasClass(std::string_view typeid_base_class_name, std::string_view class_name) const
+  {
+    for (const Entry & entry : classes_) {
+      if (entry.class_name == class_name && entry.typeid_base_class_name == typeid_base_class_name) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  std::uint64_t library_hash_;
+  bool embedded_;
+  std::vector<Entry> classes_;
+};
+
+} // namespace plugin
+
+#endif // PLUGIN_PLUGIN_MANIFEST_HPP_
@@ -0,0 +1,146 @@
+#ifndef PLUGIN_REGISTRY_SNAPSHOT_HPP_
+#define PLUGIN_REGISTRY_SNAPSHOT_HPP_
+
+#include <algorithm>
+#include <atomic>
+
+#include "FlatHashMap.hpp"
+#include "MetaObject.hpp"
+#include "VisibilityControl.h"
+
+namespace plugin {
+namespace impl {
+
+/**
+ * @brief One factory as seen by lock-free readers. The owner list is copied at publish time so readers never
+ * look at the mutable owner list of the MetaObject itself.
+ */
+struct FactorySnapshotEntry
+{
+	AbstractMetaObjectBase * factory;
+	PluginLoaderVector owners;
+
+	bool isOwnedBy(const PluginLoader * loader) const
+	{
+		return std::find(owners.begin(), owners.end(), loader) != owners.end();
+	}
+};
+
+/**
+ * @brief Immutable copy of one FactoryMap. Once published it is never modified, only replaced and reclaimed.
+ */
+struct FactorySnapshot
+{
+	unsigned long long version;
+	FlatHashMap<FactorySnapshotEntry> factories;
+};
+
+/**
+ * @class FactoryMapSlot
+ * @brief Registry storage for one base class.
+ *
+ * factories is the writable map and is only touched under getPluginBaseToFactoryMapMapMutex(). snapshot is the
+ * last published copy of it, read without locking inside a RegistryReadGuard. dirty is raised whenever factories
+ * or the owners of one of its MetaObjects change and cleared by publishFactoryMapSnapshots().
+ */
+struct FactoryMapSlot
+{
+	FactoryMapSlot() : snapshot(nullptr), dirty(false) {}
+
+	FlatHashMap<AbstractMetaObjectBase*> factories;
+	std::atomic<const FactorySnapshot*> snapshot;
+	std::atomic<bool> dirty;
+};
+
+/**
+ * @brief Enters a registry read section. Snapshots loaded inside the section are not reclaimed before the matching
+ * exitRegistryReadSection(). Sections nest and are cheap: one atomic increment on a per-thread counter shard.
+ * @return A ticket that must be handed back to exitRegistryReadSection()
+ */
+PLUGIN_LOADER_PUBLIC
+unsigned enterRegistryReadSection();
+
+/**
+ * @brief Leaves a registry read section entered with enterRegistryReadSection()
+ * @param ticket - The value enterRegistryReadSection() returned
+ */
+PLUGIN_LOADER_PUBLIC
+void exitRegistryReadSection(unsigned ticket);
+
+/**
+ * @brief Publishes a new snapshot for every FactoryMapSlot marked dirty and reclaims the ones they replace once no
+ * reader can still see them. It waits for the read sections in progress, so the caller must not hold the registry
+ * or loaded library mutex, nor any lock a reader may be about to take. Read sections themselves only look up
+ * snapshots: plugin code runs outside of them.
+ */
+PLUGIN_LOADER_PUBLIC
+void publishFactoryMapSnapshots();
+
+/**
+ * @brief Reader-side publish: same as publishFactoryMapSnapshots() unless the calling thread is inside a read
+ * section, in which case it does nothing and the reader keeps using the previous snapshot.
+ */
+PLUGIN_LOADER_PUBLIC
+void refreshFactoryMapSnapshots();
+
+/**
+ * @brief Enters a scope in which the loadLibrary() calls of the calling thread leave their registrations for a
+ * later publishFactoryMapSnapshots() instead of publishing them one library at a time. Scopes nest.
+ * Readers are not affected: they publish the slots they need themselves (@see refreshFactoryMapSnapshots()).
+ */
+PLUGIN_LOADER_PUBLIC
+void deferFactoryMapSnapshots();
+
+/**
+ * @brief Leaves a scope entered with deferFactoryMapSnapshots(). Nothing is published here.
+ */
+PLUGIN_LOADER_PUBLIC
+void resumeFactoryMapSnapshots();
+
+/**
+ * @brief Indicates if the calling thread is inside a deferFactoryMapSnapshots() scope
+ */
+PLUGIN_LOADER_PUBLIC
+bool areFactoryMapSnapshotsDeferred();
+
+/**
+ * @brief Gets the registry version, which is bumped every time a snapshot is published
+ */
+PLUGIN_LOADER_PUBLIC
+unsigned long long getRegistryVersion();
+
+/**
+ * @class RegistryReadGuard
+ * @brief Scoped registry read section
+ */
+class RegistryReadGuard
+{
+public:
+	RegistryReadGuard() : ticket_(enterRegistryReadSection()) {}
+	~RegistryReadGuard() {exitRegistryReadSection(ticket_);}
+
+	RegistryReadGuard(const RegistryReadGuard &) = delete;
+	RegistryReadGuard & operator=(const RegistryReadGuard &) = delete;
+
+private:
+	unsigned ticket_;
+};
+
+/**
+ * @class DeferredSnapshotGuard
+ * @brief Scoped deferFactoryMapSnapshots(), for batches of loads that publish once at the end
+ */
+class DeferredSnapshotGuard
+{
+public:
+	DeferredSnapshotGuard() {deferFactoryMapSnapshots();}
+	~DeferredSnapshotGuard() {resumeFactoryMapSnapshots();}
+
+	DeferredSnapshotGuard(const DeferredSnapshotGuard &) = delete;
+	DeferredSnapshotGuard & operator=(const DeferredSnapshotGuard &) = delete;
+};
+
+} // namespace impl
+} // namespace plugin
+
+#endif // PLUGIN_REGISTRY_SNAPSHOT_HPP_
@@ -1,27 +1,63 @@
 #include "SharedLibrary.hpp"
+
+#if defined(_WIN32)
 #include <Windows.h>
+#include <system_error>
+#else
+#include <dlfcn.h>
+#endif
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <set>
+#include <vector>
+
+#include "ElfImage.hpp"
+#endif
 
 #include "Exceptions.hpp"
 #include "PluginLoaderCore.hpp"
 
 namespace plugin {
 
-void SharedLibrary::load(const std::string& path)
+#if defined(_WIN32)
+
+void SharedLibrary::load(const std::string& path, const LoadOptions& options)
 {
 	std::unique_lock<std::mutex> lock(_mutex);
 
 	if (_handle) {
 		throw plugin::LibraryLoadException("Library already loaded: " + path);
 	}
-	_handle = ::LoadLibraryA(path.c_str());
+
+	if (options.noLoad || options.noDelete) {
+		DWORD flags = options.noDelete ? GET_MODULE_HANDLE_EX_FLAG_PIN : 0;
+		HMODULE module = NULL;
+		if (::GetModuleHandleExA(flags, path.c_str(), &module)) {
+			_handle = module;
+		}
+	}
+	if (!_handle && !options.noLoad) {
+		_handle = ::LoadLibraryA(path.c_str());
+		if (_handle && options.noDelete) {
+			HMODULE pinned = NULL;
+			::GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_PIN, path.c_str(), &pinned);
+		}
+	}
 
 	if (!_handle)
 	{
+		if (options.noLoad) {
+			throw plugin::LibraryLoadException("Library is not resident: " + path);
+		}
 		auto const error_id = GetLastError();
 
-		const char* err = std::system_category().message(error_id).c_str();
+		std::string err = std::system_category().message(error_id);
 		throw plugin::LibraryLoadException(
-			"Could not load library: " + (err ? std::string(err) : path));
+			"Could not load library: " + (err.empty() ? path : err));
 	}
 	_path = path;
 }
@@ -39,9 +75,9 @@ void SharedLibrary::unload()
 }
 
 
-bool SharedLibrary::isLoaded() const
+bool SharedLibrary::isResident(const std::string& path)
 {
-	return _handle != 0;
+	return ::GetModuleHandleA(path.c_str()) != NULL;
 }
 
 
@@ -55,6 +91,197 @@ void* SharedLibrary::findSymbol(const std::string& name)
 }
 
 
+void* SharedLibrary::findOwnSymbol(const std::string& name)
+{
+	// GetProcAddress only looks at the module itself
+	return findSymbol(name);
+}
+
+
+std::size_t SharedLibrary::prefetch(const std::string&)
+{
+	return 0;
+}
+
+#else
+
+void SharedLibrary::load(const std::string& path, const LoadOptions& options)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	if (_handle) {
+		throw plugin::LibraryLoadException("Library already loaded: " + path);
+	}
+
+	int flags = (options.binding == BIND_NOW) ? RTLD_NOW : RTLD_LAZY;
+	flags |= (options.scope == SCOPE_LOCAL) ? RTLD_LOCAL : RTLD_GLOBAL;
+	if (options.noDelete) {
+		flags |= RTLD_NODELETE;
+	}
+	if (options.noLoad) {
+		flags |= RTLD_NOLOAD;
+	}
+
+	_handle = ::dlopen(path.c_str(), flags);
+
+	if (!_handle)
+	{
+		if (options.noLoad) {
+			throw plugin::LibraryLoadException("Library is not resident: " + path);
+		}
+		const char* err = ::dlerror();
+		throw plugin::LibraryLoadException(
+			"Could not load library: " + (err ? std::string(err) : path));
+	}
+	_path = path;
+}
+
+
+void SharedLibrary::unload()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	if (_handle)
+	{
+		::dlclose(_handle);
+		_handle = 0;
+	}
+}
+
+
+bool SharedLibrary::isResident(const std::string& path)
+{
+	void* handle = ::dlopen(path.c_str(), RTLD_LAZY | RTLD_NOLOAD);
+	if (handle) {
+		// RTLD_NOLOAD still takes a reference on success
+		::dlclose(handle);
+		return true;
+	}
+	return false;
+}
+
+
+std::size_t SharedLibrary::prefetch(const std::string& path)
+{
+#if defined(__linux__)
+	std::vector<std::string> system_directories;
+	if (const char* library_path = std::getenv("LD_LIBRARY_PATH")) {
+		const std::string list(library_path);
+		std::string::size_type begin = 0;
+		while (begin <= list.size()) {
+			std::string::size_type end = list.find(':', begin);
+			if (std::string::npos == end) {
+				end = list.size();
+			}
+			if (end > begin) {
+				system_directories.push_back(list.substr(begin, end - begin));
+			}
+			begin = end + 1;
+		}
+	}
+	for (const char* directory : {"/usr/local/lib", "/lib", "/usr/lib", "/lib64", "/usr/lib64"}) {
+		system_directories.push_back(directory);
+	}
+
+	// The dependencies are found first: only the ELF headers and dynamic sections are read for that. The whole
+	// files are then scheduled back to back, so the kernel fetches them all concurrently.
+	std::vector<std::string> files;
+	std::set<std::string> seen;
+	std::vector<std::string> pending(1, path);
+	seen.insert(path);
+	while (!pending.empty()) {
+		const std::string file = pending.back();
+		pending.pop_back();
+		if (0 != ::access(file.c_str(), R_OK)) {
+			continue;
+		}
+		files.push_back(file);
+
+		const impl::ElfImage image(file);
+		std::vector<std::string> directories = image.getLibrarySearchPaths();
+		directories.insert(directories.end(), system_directories.begin(), system_directories.end());
+		for (const std::string& needed : image.getNeededLibraries()) {
+			if (isResident(needed)) {
+				continue;
+			}
+			std::string resolved;
+			if (needed.find('/') != std::string::npos) {
+				resolved = needed;
+			} else {
+				for (const std::string& directory : directories) {
+					const std::string candidate = directory + "/" + needed;
+					if (0 == ::access(candidate.c_str(), R_OK)) {
+						resolved = candidate;
+						break;
+					}
+				}
+			}
+			if (!resolved.empty() && seen.insert(resolved).second) {
+				pending.push_back(resolved);
+			}
+		}
+	}
+
+	std::size_t prefetched = 0;
+	for (const std::string& file : files) {
+		const int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			continue;
+		}
+		// Only schedules the read
+		::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		::close(fd);
+		++prefetched;
+	}
+	return prefetched;
+#else
+	(void)path;
+	return 0;
+#endif
+}
+
+
+void* SharedLibrary::findSymbol(const std::string& name)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	if (_handle) {
+		return ::dlsym(_handle, name.c_str());
+	}
+	return nullptr;
+}
+
+
+void* SharedLibrary::findOwnSymbol(const std::string& name)
+{
+	void* symbol = findSymbol(name);
+	if (!symbol) {
+		return nullptr;
+	}
+	// dlsym() also searches the dependencies of the library: keep the symbol
+	// only if the object defining it is this very library
+	Dl_info info;
+	if (!::dladdr(symbol, &info) || !info.dli_fname) {
+		return nullptr;
+	}
+	void* owner = ::dlopen(info.dli_fname, RTLD_LAZY | RTLD_NOLOAD);
+	if (!owner) {
+		return nullptr;
+	}
+	::dlclose(owner);
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	return owner == _handle ? symbol : nullptr;
+}
+
+#endif
+
+
+bool SharedLibrary::isLoaded() const
+{
+	return _handle != 0;
+}
+
+
 const std::string& SharedLibrary::getPath() const
 {
 	return _path;
@@ -67,12 +294,25 @@ std::string SharedLibrary::prefix()
 
 std::string SharedLibrary::suffix()
 {
+#if defined(_WIN32)
 #if defined(_DEBUG)
 	return "d.dll";
 #else
 	return ".dll";
 #endif
-
+#elif defined(__APPLE__)
+#if defined(_DEBUG)
+	return "d.dylib";
+#else
+	return ".dylib";
+#endif
+#else
+#if defined(_DEBUG)
+	return "d.so";
+#else
+	return ".so";
+#endif
+#endif
 }
 
-} // namespace plugin
\ No newline at end of file
+} // namespace plugin
@@ -39,8 +39,10 @@
 #ifndef SHARED_LIBRARY_H_
 #define SHARED_LIBRARY_H_
 
+#include <cstddef>
 #include <string>
 #include <mutex>
+#include <stdexcept>
 
 namespace plugin {
 
@@ -49,14 +51,60 @@ class SharedLibrary
 	/// loads shared libraries at run-time.
 {
 public:
+	enum Binding
+		/// When the dynamic linker resolves the
+		/// undefined symbols of a library.
+	{
+		BIND_LAZY,
+		/// Resolve function symbols on first call (RTLD_LAZY).
+		/// Cheapest load, first call of each function pays.
+
+		BIND_NOW
+		/// Resolve every symbol during load (RTLD_NOW).
+		/// Slower load, no resolution cost afterwards.
+	};
+
+	enum Scope
+		/// Whether the symbols of a library are made
+		/// available to libraries loaded later.
+	{
+		SCOPE_GLOBAL,
+		/// Symbols join the global namespace (RTLD_GLOBAL).
+
+		SCOPE_LOCAL
+		/// Symbols stay private to the library (RTLD_LOCAL).
+		/// Avoids symbol interposition work for the
+		/// libraries loaded afterwards.
+	};
+
+	struct LoadOptions
+		/// Options passed to the platform loader.
+		/// On Windows only noDelete and noLoad have an effect.
+	{
+		LoadOptions()
+			: binding(BIND_LAZY), scope(SCOPE_GLOBAL), noDelete(false), noLoad(false)
+		{}
+
+		Binding binding;
+		Scope   scope;
+		bool    noDelete;
+		/// Keep the image mapped after unload() (RTLD_NODELETE).
+
+		bool    noLoad;
+		/// Only succeed if the library is already resident
+		/// in the process (RTLD_NOLOAD). Nothing is mapped.
+	};
 
 	SharedLibrary();
 	/// Creates a SharedLibrary object.
 
 	SharedLibrary(const std::string& path);
 	/// Creates a SharedLibrary object and loads a library
-	/// from the given path, using the given flags.
-	/// See the Flags enumeration for valid values.
+	/// from the given path, using the default LoadOptions.
+
+	SharedLibrary(const std::string& path, const LoadOptions& options);
+	/// Creates a SharedLibrary object and loads a library
+	/// from the given path, using the given options.
 
 	virtual ~SharedLibrary() = default;
 	/// Destroys the SharedLibrary. The actual library
@@ -64,11 +112,36 @@ public:
 
 	void load(const std::string& path);
 	/// Loads a shared library from the given path.
-	/// Throws a LibraryAlreadyLoadedException if
-	/// a library has already been loaded.
-	/// Throws a LibraryLoadException if the library
+	/// Throws a LibraryLoadException if a library
+	/// has already been loaded or if the library
 	/// cannot be loaded.
 
+	void load(const std::string& path, const LoadOptions& options);
+	/// Loads a shared library from the given path,
+	/// using the given options. With options.noLoad
+	/// a LibraryLoadException is thrown if the library
+	/// is not already resident.
+
+	static bool isResident(const std::string& path);
+	/// Returns true iff the library at the given path
+	/// is already mapped into the process. Never loads it.
+
+	static std::size_t prefetch(const std::string& path);
+	/// Asks the operating system to read the library at
+	/// the given path into the page cache, together with
+	/// the libraries it needs (DT_NEEDED, recursively)
+	/// that are not mapped into the process yet, so that
+	/// a following load does not wait on the disk. The
+	/// dependencies are found from the ELF headers and
+	/// dynamic sections first, which are read right away.
+	/// The reads of the whole files are then scheduled
+	/// together and proceed in the background, all at
+	/// once. Dependencies are looked up in
+	/// DT_RUNPATH/DT_RPATH, LD_LIBRARY_PATH and the usual
+	/// system directories (not in ld.so.cache). Returns
+	/// the number of files prefetched: always 0 on
+	/// platforms other than Linux.
+
 	void unload();
 	/// Unloads a shared library.
 
@@ -86,6 +159,12 @@ public:
 	/// Throws a NotFoundException if the symbol
 	/// does not exist.
 
+	void* findOwnSymbol(const std::string& name);
+	/// Returns the address of the symbol with the
+	/// given name if this library defines it itself,
+	/// or null. Unlike getSymbol(), a definition
+	/// found in one of its dependencies is ignored.
+
 	const std::string& getPath() const;
 	/// Returns the path of the library, as
 	/// specified in a call to load() or the
@@ -132,6 +211,14 @@ inline SharedLibrary::SharedLibrary(const std::string& path) : _handle(NULL) {
 	load(path);
 }
 
+inline SharedLibrary::SharedLibrary(const std::string& path, const LoadOptions& options) : _handle(NULL) {
+	load(path, options);
+}
+
+inline void SharedLibrary::load(const std::string& path) {
+	load(path, LoadOptions());
+}
+
 inline bool SharedLibrary::hasSymbol(const std::string& name) {
 	return findSymbol(name) != 0;
 }
@@ -0,0 +1,159 @@
+#ifndef PLUGIN_STATIC_PLUGIN_TABLE_HPP_
+#define PLUGIN_STATIC_PLUGIN_TABLE_HPP_
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "Exceptions.hpp"
+#include "MetaObject.hpp"
+#include "PluginLoaderCore.hpp"
+
+/**
+ * Entry of a StaticPluginTable for Derived, e.g.
+ * constexpr auto PLUGINS = plugin::makeStaticPluginTable<Base>(PLUGIN_LOADER_STATIC_PLUGIN(Dog, Base), ...);
+ */
+#define PLUGIN_LOADER_STATIC_PLUGIN(Derived, Base) \
+  plugin::makeStaticPlugin<Derived, Base>(#Derived, #Base)
+
+namespace plugin {
+
+/**
+ * @brief One class of a StaticPluginTable. Every member is a constant expression, so a constexpr table of them is
+ * laid out by the compiler in read-only data and costs nothing at static initialization.
+ */
+template<class Base>
+struct StaticPlugin
+{
+  std::string_view class_name;
+  std::string_view base_class_name;
+  /// Creates the object with new, without going through the registry
+  Base * (*create)();
+  /// Creates the MetaObject registerStaticPlugins() publishes for the class
+  AbstractMetaObject<Base> * (*make_factory)(const std::string & class_name, const std::string & base_class_name);
+};
+
+namespace impl {
+
+template<class Derived, class Base>
+Base * createStaticPlugin()
+{
+  return new Derived;
+}
+
+template<class Derived, class Base>
+AbstractMetaObject<Base> * makeStaticPluginFactory(
+  const std::string & class_name, const std::string & base_class_name)
+{
+  return new MetaObject<Derived, Base>(class_name, base_class_name);
+}
+
+} // namespace impl
+
+/**
+ * @brief Makes the StaticPlugin of Derived (@see PLUGIN_LOADER_STATIC_PLUGIN)
+ */
+template<class Derived, class Base>
+constexpr StaticPlugin<Base> makeStaticPlugin(std::string_view class_name, std::string_view base_class_name)
+{
+  static_assert(std::is_base_of<Base, Derived>::value, "Static plugins must derive from their base class");
+  static_assert(std::is_default_constructible<Derived>::value, "Static plugins must be default constructible");
+  return StaticPlugin<Base>{class_name, base_class_name,
+    &impl::createStaticPlugin<Derived, Base>, &impl::makeStaticPluginFactory<Derived, Base>};
+}
+
+/**
+ * @class StaticPluginTable
+ * @brief Compile-time table of plugin classes linked into the executable.
+ *
+ * Unlike PLUGIN_LOADER_REGISTER_CLASS, nothing runs before main: the table is a constexpr aggregate and lookups in
+ * it can be resolved by the compiler, e.g. `constexpr auto & dog = PLUGINS.at("Dog");` fails to compile if there
+ * is no Dog, and `dog.create()` is then a direct call. To create the classes through the usual PluginLoader API
+ * instead, publish the table under a library name with registerStaticPlugins().
+ */
+template<class Base, std::size_t N>
+struct StaticPluginTable
+{
+  static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+  StaticPlugin<Base> plugins[N];
+
+  constexpr std::size_t size() const {return N;}
+  constexpr const StaticPlugin<Base> * begin() const {return plugins;}
+  constexpr const StaticPlugin<Base> * end() const {return plugins + N;}
+
+  /**
+   * @brief Gets the index of a class
+   * @return The index, or npos if the table has no such class
+   */
+  constexpr std::size_t find(std::string_view class_name) const
+  {
+    for (std::size_t i = 0; i < N; ++i) {
+      if (plugins[i].class_name == class_name) {
+        return i;
+      }
+    }
+    return npos;
+  }
+
+  /**
+   * @brief Gets a class by name. In a constant expression a missing class is a compile error, otherwise it throws
+   * CreateClassException.
+   */
+  constexpr const StaticPlugin<Base> & at(std::string_view class_name) const
+  {
+    std::size_t index = find(class_name);
+    if (npos == index) {
+      throw plugin::CreateClassException("Could not create instance of type " + std::string(class_name));
+    }
+    return plugins[index];
+  }
+
+  /**
+   * @brief Indicates if no class name appears twice, meant for a static_assert next to the table
+   */
+  constexpr bool hasUniqueNames() const
+  {
+    for (std::size_t i = 0; i < N; ++i) {
+      if (find(plugins[i].class_name) != i) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+/**
+ * @brief Makes a StaticPluginTable out of PLUGIN_LOADER_STATIC_PLUGIN entries
+ */
+template<class Base, class... Plugins>
+constexpr StaticPluginTable<Base, sizeof...(Plugins)> makeStaticPluginTable(const Plugins &... plugins)
+{
+  static_assert(sizeof...(Plugins) > 0, "A static plugin table needs at least one class");
+  return StaticPluginTable<Base, sizeof...(Plugins)>{{plugins...}};
+}
+
+/**
+ * @brief Publishes a table as a library that PluginLoader and MultiLibraryPluginLoader can load by library_path
+ * like any shared library, except that nothing is opened: loading binds the table's factories to the loader and
+ * unloading unbinds them. The factories are built here, once, under a single registry lock.
+ * @param table - The classes to publish
+ * @param library_path - The name loaders use for the table. It must not be the path of a real library.
+ * @throws LibraryLoadException if library_path is already registered or loaded
+ */
+template<class Base, std::size_t N>
+void registerStaticPlugins(const StaticPluginTable<Base, N> & table, const std::string & library_path)
+{
+  impl::MetaObjectVector meta_objects;
+  meta_objects.reserve(N);
+  for (const StaticPlugin<Base> & plugin : table) {
+    meta_objects.push_back(
+      plugin.make_factory(std::string(plugin.class_name), std::string(plugin.base_class_name)));
+  }
+  impl::registerStaticLibrary(library_path, meta_objects);
+}
+
+} // namespace plugin
+
+#endif // PLUGIN_STATIC_PLUGIN_TABLE_HPP_
@@ -0,0 +1,213 @@
+#include "UsageProfile.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+#include "Exceptions.hpp"
+#include "MetaObject.hpp"
+#include "PluginLoaderCore.hpp"
+
+namespace plugin
+{
+
+namespace
+{
+
+const char * const PROFILE_HEADER = "plugin_loader_usage_profile";
+const unsigned PROFILE_VERSION = 1;
+
+/**
+ * What impl::loadLibrary() reported and what destroyed factories had counted, the rest is read from the live
+ * factories on capture()
+ */
+struct UsageRecorder
+{
+  std::mutex mutex;
+  UsageProfile recorded;  // Under mutex
+};
+
+UsageRecorder & getUsageRecorder()
+{
+  static UsageRecorder instance;
+  return instance;
+}
+
+} // namespace
+
+std::atomic<bool> UsageProfile::recording_(false);
+
+void UsageProfile::setRecording(bool recording)
+{
+  recording_.store(recording, std::memory_order_relaxed);
+}
+
+UsageProfile UsageProfile::capture()
+{
+  UsageProfile profile;
+  {
+    std::unique_lock<std::recursive_mutex> registry_lock(impl::getPluginBaseToFactoryMapMapMutex());
+    impl::MetaObjectVector meta_objects = impl::allMetaObjects();
+    const impl::MetaObjectVector & graveyard = impl::getMetaObjectGraveyard();
+    for (AbstractMetaObjectBase * meta_obj : graveyard) {
+      if (std::find(meta_objects.begin(), meta_objects.end(), meta_obj) == meta_objects.end()) {
+        meta_objects.push_back(meta_obj);
+      }
+    }
+    for (AbstractMetaObjectBase * meta_obj : meta_objects) {
+      if (meta_obj->getCreationCount() > 0) {
+        profile.addCreations(meta_obj->getAssociatedLibraryPath(), meta_obj->typeidBaseClassName(),
+          meta_obj->className(), meta_obj->getCreationCount());
+      }
+    }
+  }
+  {
+    UsageRecorder & recorder = getUsageRecorder();
+    std::unique_lock<std::mutex> lock(recorder.mutex);
+    profile.merge(recorder.recorded);
+  }
+  return profile;
+}
+
+bool UsageProfile::read(const std::string & profile_path)
+{
+  libraries_.clear();
+
+  std::ifstream file(profile_path);
+  std::string header;
+  unsigned version = 0;
+  if (!(file >> header >> version) || header != PROFILE_HEADER || version != PROFILE_VERSION) {
+    return false;
+  }
+
+  std::string line;
+  std::getline(file, line);
+  while (std::getline(file, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    std::istringstream fields(line);
+    std::string key;
+    std::string first;
+    std::string second;
+    std::string last;
+    bool valid = std::getline(fields, key, '\t') && std::getline(fields, first, '\t') &&
+      std::getline(fields, second, '\t') && std::getline(fields, last) && !last.empty();
+    try {
+      if (valid && key == "library") {
+        libraries_.push_back(LibraryUsage{last, std::stoull(first), std::stoull(second), {}});
+      } else if (valid && key == "class" && !libraries_.empty()) {
+        libraries_.back().classes.push_back(ClassUsage{first, last, std::stoull(second)});
+      } else {
+        valid = false;
+      }
+    }
+    catch (const std::exception &) {
+      valid = false;
+    }
+    if (!valid) {
+      libraries_.clear();
+      return false;
+    }
+  }
+  sort();
+  return true;
+}
+
+void UsageProfile::write(const std::string & profile_path) const
+{
+  std::ofstream file(profile_path, std::ios::trunc);
+  file << PROFILE_HEADER << ' ' << PROFILE_VERSION << '\n';
+  for (const LibraryUsage & library : libraries_) {
+    file << "library\t" << library.loads << '\t' << library.load_microseconds << '\t' << library.library_path << '\n';
+    for (const ClassUsage & usage : library.classes) {
+      file << "class\t" << usage.typeid_base_class_name << '\t' << usage.creations << '\t' << usage.class_name <<
+        '\n';
+    }
+  }
+  file.close();
+  if (!file) {
+    throw plugin::PluginLoaderException("Could not write usage profile " + profile_path);
+  }
+}
+
+void UsageProfile::merge(const UsageProfile & other)
+{
+  for (const LibraryUsage & other_library : other.libraries_) {
+    LibraryUsage & library = getLibrary(other_library.library_path);
+    library.loads += other_library.loads;
+    library.load_microseconds += other_library.load_microseconds;
+    for (const ClassUsage & usage : other_library.classes) {
+      addCreations(library.library_path, usage.typeid_base_class_name, usage.class_name, usage.creations);
+    }
+  }
+  sort();
+}
+
+const UsageProfile::LibraryUsage * UsageProfile::findLibrary(const std::string & library_path) const
+{
+  for (const LibraryUsage & library : libraries_) {
+    if (library.library_path == library_path) {
+      return &library;
+    }
+  }
+  return nullptr;
+}
+
+void UsageProfile::recordLoad(const std::string & library_path, std::uint64_t microseconds)
+{
+  UsageRecorder & recorder = getUsageRecorder();
+  std::unique_lock<std::mutex> lock(recorder.mutex);
+  LibraryUsage & library = recorder.recorded.getLibrary(library_path);
+  ++library.loads;
+  library.load_microseconds += microseconds;
+}
+
+void UsageProfile::recordRetiredFactory(AbstractMetaObjectBase & factory)
+{
+  UsageRecorder & recorder = getUsageRecorder();
+  std::unique_lock<std::mutex> lock(recorder.mutex);
+  recorder.recorded.addCreations(factory.getAssociatedLibraryPath(), factory.typeidBaseClassName(),
+    factory.className(), factory.getCreationCount());
+}
+
+UsageProfile::LibraryUsage & UsageProfile::getLibrary(const std::string & library_path)
+{
+  for (LibraryUsage & library : libraries_) {
+    if (library.library_path == library_path) {
+      return library;
+    }
+  }
+  libraries_.push_back(LibraryUsage{library_path, 0, 0, {}});
+  return libraries_.back();
+}
+
+void UsageProfile::addCreations(
+  const std::string & library_path, const std::string & typeid_base_class_name, const std::string & class_name,
+  std::uint64_t creations)
+{
+  LibraryUsage & library = getLibrary(library_path);
+  for (ClassUsage & usage : library.classes) {
+    if (usage.class_name == class_name && usage.typeid_base_class_name == typeid_base_class_name) {
+      usage.creations += creations;
+      return;
+    }
+  }
+  library.classes.push_back(ClassUsage{typeid_base_class_name, class_name, creations});
+}
+
+void UsageProfile::sort()
+{
+  std::sort(libraries_.begin(), libraries_.end(), [](const LibraryUsage & a, const LibraryUsage & b) {
+      return a.library_path < b.library_path;
+    });
+  for (LibraryUsage & library : libraries_) {
+    std::sort(library.classes.begin(), library.classes.end(), [](const ClassUsage & a, const ClassUsage & b) {
+        return a.class_name != b.class_name ? a.class_name < b.class_name :
+          a.typeid_base_class_name < b.typeid_base_class_name;
+      });
+  }
+}
+
+} // namespace plugin
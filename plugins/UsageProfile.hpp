@@ -0,0 +1,136 @@
+#ifndef PLUGIN_USAGE_PROFILE_HPP_
+#define PLUGIN_USAGE_PROFILE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "VisibilityControl.h"
+
+namespace plugin {
+
+class AbstractMetaObjectBase;
+
+/**
+ * @class UsageProfile
+ * @brief Which plugin libraries a process loaded, how long each load took and how many objects of each class were
+ * created, to be saved at shutdown and used at the next start (@see MultiLibraryPluginLoader::loadWithProfile()).
+ *
+ * Nothing is recorded until setRecording(true). Creations are counted on the factories themselves, so recording
+ * costs one relaxed atomic increment per object; loads are timed in impl::loadLibrary(). Instances from an
+ * InstancePool and unmanaged instances are not counted.
+ *
+ * The file is text: a "plugin_loader_usage_profile <version>" line, then per library a
+ * "library <loads> <load microseconds> <path>" line followed by its "class <typeid(Base).name()> <creations> <class name>"
+ * lines, fields separated by tabs.
+ */
+class UsageProfile
+{
+public:
+  struct ClassUsage
+  {
+    std::string typeid_base_class_name;
+    std::string class_name;
+    std::uint64_t creations;
+  };
+
+  struct LibraryUsage
+  {
+    std::string library_path;
+    std::uint64_t loads;
+    std::uint64_t load_microseconds;  // Total over all loads
+    std::vector<ClassUsage> classes;
+
+    /**
+     * @brief Gets the number of objects created from all classes of the library
+     */
+    std::uint64_t getCreations() const
+    {
+      std::uint64_t creations = 0;
+      for (const ClassUsage & usage : classes) {
+        creations += usage.creations;
+      }
+      return creations;
+    }
+  };
+
+  /**
+   * @brief Turns recording on or off for the whole process
+   */
+  PLUGIN_LOADER_PUBLIC
+  static void setRecording(bool recording);
+
+  static bool isRecording() {return recording_.load(std::memory_order_relaxed);}
+
+  /**
+   * @brief Gets what was recorded in this process so far, libraries sorted by path and classes by name
+   */
+  PLUGIN_LOADER_PUBLIC
+  static UsageProfile capture();
+
+  /**
+   * @brief Replaces the content of this profile with the one of a file
+   * @return false if the file is missing or malformed, in which case this profile is left empty
+   */
+  PLUGIN_LOADER_PUBLIC
+  bool read(const std::string & profile_path);
+
+  /**
+   * @brief Writes this profile to a file
+   * @throws PluginLoaderException if it cannot be written
+   */
+  PLUGIN_LOADER_PUBLIC
+  void write(const std::string & profile_path) const;
+
+  /**
+   * @brief Adds the counts of another profile to this one, e.g. to keep a history over several runs
+   */
+  PLUGIN_LOADER_PUBLIC
+  void merge(const UsageProfile & other);
+
+  const std::vector<LibraryUsage> & getLibraries() const {return libraries_;}
+
+  /**
+   * @brief Gets the usage of a library, nullptr if it is not in the profile
+   */
+  PLUGIN_LOADER_PUBLIC
+  const LibraryUsage * findLibrary(const std::string & library_path) const;
+
+  /**
+   * @brief Indicates if an object was created from a library
+   */
+  bool isHot(const std::string & library_path) const
+  {
+    const LibraryUsage * usage = findLibrary(library_path);
+    return usage != nullptr && usage->getCreations() > 0;
+  }
+
+  /**
+   * @brief Called by impl::loadLibrary() while recording
+   */
+  PLUGIN_LOADER_PUBLIC
+  static void recordLoad(const std::string & library_path, std::uint64_t microseconds);
+
+  /**
+   * @brief Keeps the creations counted on a factory about to be destroyed, @see AbstractMetaObjectBase
+   */
+  PLUGIN_LOADER_PUBLIC
+  static void recordRetiredFactory(AbstractMetaObjectBase & factory);
+
+private:
+  LibraryUsage & getLibrary(const std::string & library_path);
+  void addCreations(
+    const std::string & library_path, const std::string & typeid_base_class_name, const std::string & class_name,
+    std::uint64_t creations);
+  void sort();
+
+  std::vector<LibraryUsage> libraries_;
+
+  PLUGIN_LOADER_PUBLIC
+  static std::atomic<bool> recording_;
+};
+
+} // namespace plugin
+
+#endif // PLUGIN_USAGE_PROFILE_HPP_
@@ -40,10 +40,19 @@
 	#else
 		#define PLUGIN_LOADER_PUBLIC PLUGIN_LOADER_IMPORT
 	#endif
-#else
+#elif defined(_WIN32)
 	#define PLUGIN_LOADER_EXPORT __declspec(dllexport)
 	#define PLUGIN_LOADER_IMPORT __declspec(dllimport)
 
+	#ifdef PLUGIN_LOADER_BUILDING_DLL
+		#define PLUGIN_LOADER_PUBLIC PLUGIN_LOADER_EXPORT
+	#else
+		#define PLUGIN_LOADER_PUBLIC PLUGIN_LOADER_IMPORT
+	#endif
+#else
+	#define PLUGIN_LOADER_EXPORT __attribute__((visibility("default")))
+	#define PLUGIN_LOADER_IMPORT
+
 	#ifdef PLUGIN_LOADER_BUILDING_DLL
 		#define PLUGIN_LOADER_PUBLIC PLUGIN_LOADER_EXPORT
 	#else
@@ -37,4 +37,14 @@ public:
   virtual void saySomething() = 0;
 };
 
+namespace zoo
+{
+class Keeper
+{
+public:
+  virtual ~Keeper() {}
+  virtual void feed() = 0;
+};
+}  // namespace zoo
+
 #endif  // BASE_HPP_
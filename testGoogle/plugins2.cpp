@@ -28,6 +28,7 @@
  */
 
 #include <iostream>
+#include <string>
 
 #include <plugins/PluginLoader.hpp>
 
@@ -37,6 +38,9 @@ class Robot : public Base
 {
 public:
   virtual void saySomething() {std::cout << "Beep boop" << std::endl;}
+
+  // Lets an InstancePool recycle robots
+  void reset() {}
 };
 
 class Alien : public Base
@@ -57,8 +61,60 @@ public:
   virtual void saySomething() {std::cout << "Brains!!!" << std::endl;}
 };
 
+class Ghost : public Base
+{
+public:
+  explicit Ghost(std::string name) : name_(name) {}
+  virtual void saySomething() {std::cout << "Boo, I am " << name_ << std::endl;}
+
+private:
+  std::string name_;
+};
+
+class Parrot : public Base
+{
+public:
+  Parrot(const std::string & word, int times) : word_(word), times_(times) {}
+  virtual void saySomething()
+  {
+    for (int i = 0; i < times_; ++i) {
+      std::cout << word_ << "! ";
+    }
+    std::cout << std::endl;
+  }
+
+private:
+  std::string word_;
+  int times_;
+};
+
+Parrot makeParrot(std::string word, int times)
+{
+  return Parrot(word, times > 0 ? times : 1);
+}
+
+// Registered under names that are not the qualified name of their base
+using zoo::Keeper;
+typedef zoo::Keeper Warden;
+
+class NightKeeper : public Keeper
+{
+public:
+  virtual void feed() {std::cout << "Feeding the owls" << std::endl;}
+};
+
+class DayKeeper : public Warden
+{
+public:
+  virtual void feed() {std::cout << "Feeding the lions" << std::endl;}
+};
+
 
 PLUGIN_LOADER_REGISTER_CLASS(Robot, Base)
 PLUGIN_LOADER_REGISTER_CLASS(Alien, Base)
 PLUGIN_LOADER_REGISTER_CLASS(Monster, Base)
 PLUGIN_LOADER_REGISTER_CLASS(Zombie, Base)
+PLUGIN_LOADER_REGISTER_CLASS_WITH_ARGS(Ghost, Base, std::string)
+PLUGIN_LOADER_REGISTER_FACTORY(Parrot, Base, makeParrot)
+PLUGIN_LOADER_REGISTER_CLASS(NightKeeper, Keeper)
+PLUGIN_LOADER_REGISTER_CLASS(DayKeeper, Warden)
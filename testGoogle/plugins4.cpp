@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Built once per PLUGIN_GROUP (see CMakeLists.txt) so that every library registers classes of its own,
+ * e.g. Gear3, Spring3 and Lever3 for group 3. Used to load many libraries concurrently.
+ */
+
+#include <iostream>
+
+#include <plugins/PluginLoader.hpp>
+
+#include "base.hpp"
+
+#define GROUP_CLASS_HOP(name, group) name ## group
+#define GROUP_CLASS(name, group) GROUP_CLASS_HOP(name, group)
+
+#define GEAR GROUP_CLASS(Gear, PLUGIN_GROUP)
+#define SPRING GROUP_CLASS(Spring, PLUGIN_GROUP)
+#define LEVER GROUP_CLASS(Lever, PLUGIN_GROUP)
+
+class GEAR : public Base
+{
+public:
+  virtual void saySomething() {std::cout << "Click " << PLUGIN_GROUP << std::endl;}
+};
+
+class SPRING : public Base
+{
+public:
+  virtual void saySomething() {std::cout << "Boing " << PLUGIN_GROUP << std::endl;}
+};
+
+class LEVER : public Base
+{
+public:
+  virtual void saySomething() {std::cout << "Clunk " << PLUGIN_GROUP << std::endl;}
+};
+
+PLUGIN_LOADER_REGISTER_CLASS(GEAR, Base)
+PLUGIN_LOADER_REGISTER_CLASS(SPRING, Base)
+PLUGIN_LOADER_REGISTER_CLASS(LEVER, Base)
@@ -27,12 +27,17 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <atomic>
 #include <chrono>
 #include <cstddef>
+#include <cstdlib>
+#include <new>
 #include <functional>
 #include <iostream>
+#include <memory_resource>
 #include <string>
 #include <thread>
+#include <typeinfo>
 #include <vector>
 
 #include <plugins/PluginLoader.hpp>
@@ -42,8 +47,38 @@
 
 #include "base.hpp"
 
+#ifdef _WIN32
 const std::string LIBRARY_1 = "PluginLoader_TestPlugins1.dll";  // NOLINT
 const std::string LIBRARY_2 = "PluginLoader_TestPlugins2.dll";  // NOLINT
+#else
+const std::string LIBRARY_1 = "./libPluginLoader_TestPlugins1.so";  // NOLINT
+const std::string LIBRARY_2 = "./libPluginLoader_TestPlugins2.so";  // NOLINT
+#endif
+
+#ifndef _WIN32
+// Counts every heap allocation in the process, see unique_ptr_test.cpp
+static std::atomic<size_t> g_allocations(0);
+
+void * operator new(std::size_t size)
+{
+  ++g_allocations;
+  if (void * ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void * ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void * ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+#endif
+
 TEST(PluginLoaderSharedPtrTest, basicLoad) {
   try {
     plugin::PluginLoader loader1(LIBRARY_1, false);
@@ -150,6 +185,108 @@ TEST(PluginLoaderSharedPtrTest, invalidBase) {
   }
 }
 
+#ifndef _WIN32
+TEST(PluginLoaderSharedPtrTest, singleAllocationPerInstance) {
+  plugin::PluginLoader loader1(LIBRARY_1, false);
+  const std::string class_name = "Dog";
+  plugin::FactoryHandle<Base> factory = loader1.getFactory<Base>(class_name);
+  // Warm up: publishes the registry snapshot and sets up per-thread reader state
+  loader1.createSharedInstance<Base>(class_name);
+
+  size_t before = g_allocations;
+  for (int i = 0; i < 100; ++i) {
+    std::shared_ptr<Base> obj = loader1.createSharedInstance<Base>(class_name);
+    ASSERT_TRUE(nullptr != obj);
+    ASSERT_EQ(1, obj.use_count());
+  }
+  ASSERT_EQ(100u, g_allocations - before);
+
+  before = g_allocations;
+  for (int i = 0; i < 100; ++i) {
+    std::shared_ptr<Base> obj = factory.create();
+    ASSERT_TRUE(nullptr != obj);
+  }
+  ASSERT_EQ(100u, g_allocations - before);
+}
+#endif
+
+#ifndef _WIN32
+TEST(PluginLoaderSharedPtrTest, memoryResource) {
+  plugin::PluginLoader loader1(LIBRARY_1, true);
+  // Keeps the library loaded, so only the instances below are measured
+  std::shared_ptr<Base> keep_loaded = loader1.createSharedInstance<Base>("Cat");
+  plugin::FactoryHandle<Base> factory = loader1.getFactory<Base>("Dog");
+
+  alignas(std::max_align_t) unsigned char buffer[4096];
+  std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+  size_t before = g_allocations;
+  {
+    std::shared_ptr<Base> cat = loader1.createInstance<Base>("Cat", &arena);
+    std::shared_ptr<Base> dog = factory.create(&arena);
+    ASSERT_TRUE(reinterpret_cast<unsigned char *>(cat.get()) >= buffer);
+    ASSERT_TRUE(reinterpret_cast<unsigned char *>(cat.get()) < buffer + sizeof(buffer));
+    ASSERT_TRUE(reinterpret_cast<unsigned char *>(dog.get()) >= buffer);
+    ASSERT_TRUE(reinterpret_cast<unsigned char *>(dog.get()) < buffer + sizeof(buffer));
+  }
+  ASSERT_EQ(0u, g_allocations - before);
+
+  // Instances in the arena take part in on-demand unloading like any other
+  std::shared_ptr<Base> cat = loader1.createInstance<Base>("Cat", &arena);
+  keep_loaded.reset();
+  ASSERT_TRUE(loader1.isLibraryLoaded());
+  cat.reset();
+  ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+}
+#endif
+
+TEST(PluginLoaderSharedPtrTest, batchCreation) {
+  plugin::PluginLoader loader1(LIBRARY_1, true);
+  {
+    std::vector<std::shared_ptr<Base>> dogs = loader1.createInstances<Base>("Dog", 1000, 4);
+    ASSERT_EQ(1000u, dogs.size());
+    ASSERT_TRUE(loader1.isLibraryLoaded());
+    for (auto & dog : dogs) {
+      ASSERT_TRUE(nullptr != dog);
+      ASSERT_EQ(1, dog.use_count());
+    }
+
+    std::vector<std::string> names = {"Cat", "Cat", "Cow", "Dog"};
+    std::vector<std::shared_ptr<Base>> animals = loader1.createInstances<Base>(names);
+    ASSERT_EQ(names.size(), animals.size());
+    for (size_t i = 0; i < names.size(); ++i) {
+      ASSERT_NE(std::string::npos, std::string(typeid(*animals[i]).name()).find(names[i]));
+    }
+    dogs.clear();
+    ASSERT_TRUE(loader1.isLibraryLoaded());
+  }
+  // Every instance of the batch gave its reference back
+  ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+
+  try {
+    loader1.createInstances<Base>(std::vector<std::string>{"Dog", "Bear"});
+  } catch (const plugin::CreateClassException &) {
+    SUCCEED();
+    return;
+  }
+  FAIL() << "Did not throw exception as expected.\n";
+}
+
+TEST(PluginLoaderSharedPtrTest, sharedInstanceOutlivesCopies) {
+  plugin::PluginLoader loader1(LIBRARY_1, true);
+  {
+    std::shared_ptr<Base> obj = loader1.createSharedInstance<Base>("Cat");
+    std::weak_ptr<Base> weak = obj;
+    std::shared_ptr<Base> copy = obj;
+    obj.reset();
+    ASSERT_TRUE(loader1.isLibraryLoaded());
+    copy->saySomething();
+    copy.reset();
+    // The object is gone and the library unloaded, while the weak_ptr still holds the control block
+    ASSERT_TRUE(weak.expired());
+    ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+  }
+}
+
 void wait(int seconds)
 {
   std::this_thread::sleep_for(std::chrono::seconds(seconds));
@@ -33,8 +33,11 @@
 
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <chrono>
 #include <cstddef>
+#include <cstdlib>
+#include <new>
 #include <functional>
 #include <iostream>
 #include <string>
@@ -43,11 +46,41 @@
 
 #include "base.hpp"
 
+#ifdef _WIN32
 const std::string LIBRARY_1 = "PluginLoader_TestPlugins1.dll";  // NOLINT
 const std::string LIBRARY_2 = "PluginLoader_TestPlugins2.dll";  // NOLINT
+#else
+const std::string LIBRARY_1 = "./libPluginLoader_TestPlugins1.so";  // NOLINT
+const std::string LIBRARY_2 = "./libPluginLoader_TestPlugins2.so";  // NOLINT
+#endif
 
 using plugin::PluginLoader;
 
+#ifndef _WIN32
+// Counts every heap allocation in the process, including the plugin libraries' `new C` which binds to this
+// replacement on ELF platforms. Windows DLLs keep their own CRT heap, so the count would be meaningless there.
+static std::atomic<size_t> g_allocations(0);
+
+void * operator new(std::size_t size)
+{
+  ++g_allocations;
+  if (void * ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void * ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void * ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+#endif
+
 TEST(PluginLoaderUniquePtrTest, basicLoad) {
   try {
     PluginLoader loader1(LIBRARY_1, false);
@@ -101,6 +134,36 @@ TEST(PluginLoaderUniquePtrTest, nonExistentPlugin) {
   FAIL() << "Did not throw exception as expected.\n";
 }
 
+TEST(PluginLoaderUniquePtrTest, compactDeleter) {
+  static_assert(
+    sizeof(PluginLoader::UniquePtr<Base>) == 2 * sizeof(void *),
+    "UniquePtr should hold the object and its PluginLoader only");
+
+  PluginLoader loader1(LIBRARY_1, false);
+  PluginLoader::UniquePtr<Base> obj = loader1.createUniqueInstance<Base>("Dog");
+  ASSERT_EQ(&loader1, obj.get_deleter().getPluginLoader());
+
+  // A released pointer is handed back through the original deleter
+  PluginLoader::DeleterType<Base> deleter = obj.get_deleter();
+  deleter(obj.release());
+}
+
+#ifndef _WIN32
+TEST(PluginLoaderUniquePtrTest, singleAllocationPerInstance) {
+  PluginLoader loader1(LIBRARY_1, false);
+  const std::string class_name = "Dog";
+  // Warm up: publishes the registry snapshot and sets up per-thread reader state
+  loader1.createUniqueInstance<Base>(class_name);
+
+  size_t before = g_allocations;
+  for (int i = 0; i < 100; ++i) {
+    PluginLoader::UniquePtr<Base> obj = loader1.createUniqueInstance<Base>(class_name);
+    ASSERT_TRUE(nullptr != obj);
+  }
+  ASSERT_EQ(100u, g_allocations - before);
+}
+#endif
+
 void wait(int seconds)
 {
   std::this_thread::sleep_for(std::chrono::seconds(seconds));
@@ -27,25 +27,51 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <functional>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <vector>
 
+#include <plugins/ElfImage.hpp>
+#include <plugins/InstancePool.hpp>
+#include <plugins/PluginIndex.hpp>
 #include <plugins/PluginLoader.hpp>
 #include <plugins/MultiLibraryPluginLoader.hpp>
 
 #include <plugins/PluginLoaderCore.hpp>
+#include <plugins/PluginManifest.hpp>
+#include <plugins/StaticPluginTable.hpp>
+#include <plugins/UsageProfile.hpp>
 
 #include "gtest/gtest.h"
 
 #include "base.hpp"
 
+#ifdef _WIN32
 const std::string LIBRARY_1 = "PluginLoader_TestPlugins1.dll";  // NOLINT
 const std::string LIBRARY_2 = "PluginLoader_TestPlugins2.dll";  // NOLINT
+const std::string LIBRARY_3 = "PluginLoader_TestPlugins3.dll";  // NOLINT
+const std::string GROUP_LIBRARY_PREFIX = "PluginLoader_TestPlugins4_";  // NOLINT
+const std::string GROUP_LIBRARY_SUFFIX = ".dll";  // NOLINT
+#else
+const std::string LIBRARY_1 = "./libPluginLoader_TestPlugins1.so";  // NOLINT
+const std::string LIBRARY_2 = "./libPluginLoader_TestPlugins2.so";  // NOLINT
+const std::string LIBRARY_3 = "./libPluginLoader_TestPlugins3.so";  // NOLINT
+const std::string GROUP_LIBRARY_PREFIX = "./libPluginLoader_TestPlugins4_";  // NOLINT
+const std::string GROUP_LIBRARY_SUFFIX = ".so";  // NOLINT
+#endif
 
 TEST(PluginLoaderTest, basicLoad) {
 	try {
@@ -143,6 +169,61 @@ TEST(PluginLoaderTest, nonExistentLibrary) {
 	FAIL() << "Did not throw exception as expected.\n";
 }
 
+TEST(PluginLoaderTest, loadOptions) {
+	try {
+		plugin::SharedLibrary::LoadOptions options;
+		options.binding = plugin::SharedLibrary::BIND_NOW;
+		options.scope = plugin::SharedLibrary::SCOPE_LOCAL;
+		plugin::PluginLoader loader1(LIBRARY_1, false, options);
+		ASSERT_TRUE(loader1.isLibraryLoaded());
+		ASSERT_TRUE(plugin::SharedLibrary::isResident(LIBRARY_1));
+		loader1.createInstance<Base>("Cat")->saySomething();
+	}
+	catch (plugin::PluginLoaderException & e) {
+		FAIL() << "PluginLoaderException: " << e.what() << "\n";
+	}
+
+	plugin::SharedLibrary::LoadOptions probe;
+	probe.noLoad = true;
+	ASSERT_FALSE(plugin::SharedLibrary::isResident("libDoesNotExist.dll"));
+	try {
+		plugin::PluginLoader loader2("libDoesNotExist.dll", false, probe);
+	}
+	catch (const plugin::LibraryLoadException &) {
+		SUCCEED();
+		return;
+	}
+	FAIL() << "Did not throw exception as expected.\n";
+}
+
+TEST(PluginLoaderTest, flatHashMap) {
+	plugin::impl::FlatHashMap<int> map;
+	for (int i = 0; i < 20000; ++i) {
+		map["Class" + std::to_string(i)] = i;
+	}
+	ASSERT_EQ(20000u, map.size());
+	for (int i = 0; i < 20000; i += 2) {
+		ASSERT_EQ(1u, map.erase("Class" + std::to_string(i)));
+	}
+	ASSERT_EQ(10000u, map.size());
+	for (int i = 0; i < 20000; ++i) {
+		auto itr = map.find("Class" + std::to_string(i));
+		if (i % 2) {
+			ASSERT_TRUE(itr != map.end());
+			ASSERT_EQ(i, itr->second);
+		}
+		else {
+			ASSERT_TRUE(itr == map.end());
+		}
+	}
+	size_t visited = 0;
+	for (auto & it : map) {
+		ASSERT_EQ(1, it.second % 2);
+		++visited;
+	}
+	ASSERT_EQ(10000u, visited);
+}
+
 class InvalidBase
 {
 };
@@ -215,6 +296,403 @@ TEST(PluginLoaderTest, threadSafety) {
 	}
 }
 
+TEST(PluginLoaderTest, createWhileOtherLibraryReloads) {
+	plugin::PluginLoader loader1(LIBRARY_1);
+	ASSERT_TRUE(loader1.isLibraryLoaded());
+
+	// Creation runs on registry snapshots; a concurrent load/unload of another library must
+	// neither block it nor pull a snapshot out from under it.
+	std::atomic<bool> done(false);
+	std::atomic<size_t> created(0);
+	try {
+		std::vector<std::thread> client_threads;
+		for (size_t c = 0; c < 8; c++) {
+			client_threads.emplace_back([&]() {
+				while (!done) {
+					loader1.createInstance<Base>("Dog")->saySomething();
+					++created;
+				}
+			});
+		}
+
+		unsigned long long version = plugin::impl::getRegistryVersion();
+		for (size_t c = 0; c < 50; c++) {
+			plugin::PluginLoader loader2(LIBRARY_2);
+			EXPECT_TRUE(loader2.isClassAvailable<Base>("Robot"));
+			loader2.createInstance<Base>("Robot")->saySomething();
+		}
+		done = true;
+		for (auto & client_thread : client_threads) {
+			client_thread.join();
+		}
+
+		ASSERT_GT(plugin::impl::getRegistryVersion(), version);
+		ASSERT_GT(created.load(), 0u);
+		ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+	}
+	catch (const plugin::PluginLoaderException &) {
+		done = true;
+		FAIL() << "Unexpected PluginLoaderException.";
+	}
+}
+
+TEST(PluginLoaderTest, lazyCreateWhileReleasing) {
+	plugin::PluginLoader loader1(LIBRARY_1, true);
+
+	// In on-demand mode the last instance unloads the library: one being created meanwhile must keep it loaded,
+	// or load it again, but never run from a closed library.
+	try {
+		std::vector<std::thread> client_threads;
+		for (size_t c = 0; c < 8; c++) {
+			client_threads.emplace_back([&loader1]() {
+				for (size_t i = 0; i < 200; i++) {
+					loader1.createInstance<Base>("Dog")->saySomething();
+				}
+			});
+		}
+		for (auto & client_thread : client_threads) {
+			client_thread.join();
+		}
+	}
+	catch (const plugin::PluginLoaderException &) {
+		FAIL() << "Unexpected PluginLoaderException.";
+	}
+	ASSERT_FALSE(loader1.isLibraryLoaded());
+}
+
+plugin::PluginLoader * g_inner_loader = nullptr;
+
+class Nest : public Base
+{
+public:
+	// Plugin code that creates another plugin and asks about load state, which takes the loaded library mutex
+	Nest() : inner_(g_inner_loader->createInstance<Base>("Dog"))
+	{
+		loaded_ = plugin::impl::isLibraryLoadedByAnybody(LIBRARY_2);
+	}
+	virtual void saySomething() {inner_->saySomething();}
+
+private:
+	std::shared_ptr<Base> inner_;
+	bool loaded_;
+};
+
+TEST(PluginLoaderTest, createFromPluginConstructor) {
+	plugin::PluginLoader loader1(LIBRARY_1);
+	g_inner_loader = &loader1;
+	const std::string library = "static:nest";
+	plugin::registerStaticPlugins(plugin::makeStaticPluginTable<Base>(PLUGIN_LOADER_STATIC_PLUGIN(Nest, Base)), library);
+	plugin::PluginLoader nest_loader(library);
+
+	// Loads and unloads wait for the registry readers: the constructors must not run inside a read section
+	std::atomic<bool> done(false);
+	std::thread reloader([&done]() {
+		while (!done) {
+			plugin::PluginLoader loader2(LIBRARY_2);
+		}
+	});
+	std::vector<std::thread> client_threads;
+	for (size_t c = 0; c < 4; c++) {
+		client_threads.emplace_back([&nest_loader]() {
+			for (size_t i = 0; i < 200; i++) {
+				nest_loader.createInstance<Base>("Nest")->saySomething();
+			}
+		});
+	}
+	for (auto & client_thread : client_threads) {
+		client_thread.join();
+	}
+	done = true;
+	reloader.join();
+	g_inner_loader = nullptr;
+	ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+}
+
+TEST(PluginLoaderTest, concurrentLoads) {
+	const size_t GROUPS = 8;
+	const size_t ROUNDS = 20;
+	std::vector<std::string> libraries;
+	for (size_t group = 1; group <= GROUPS; ++group) {
+		libraries.push_back(GROUP_LIBRARY_PREFIX + std::to_string(group) + GROUP_LIBRARY_SUFFIX);
+	}
+
+	// Every class is registered once, under the library defining it and the loader that opened it
+	auto checkRegistrations = [&](const std::vector<std::unique_ptr<plugin::PluginLoader>> & loaders) {
+		for (size_t i = 0; i < GROUPS; ++i) {
+			const std::string group = std::to_string(i + 1);
+			plugin::impl::MetaObjectVector meta_objects = plugin::impl::allMetaObjectsForLibrary(libraries[i]);
+			ASSERT_EQ(3u, meta_objects.size());
+			for (auto & meta_obj : meta_objects) {
+				EXPECT_EQ(libraries[i], meta_obj->getAssociatedLibraryPath());
+				EXPECT_TRUE(meta_obj->isOwnedBy(loaders[i].get()));
+				EXPECT_EQ(group, meta_obj->className().substr(meta_obj->className().size() - group.size()));
+			}
+			loaders[i]->createInstance<Base>("Gear" + group)->saySomething();
+		}
+	};
+
+	auto loadAll = [&](bool concurrently) {
+		std::vector<std::unique_ptr<plugin::PluginLoader>> loaders(GROUPS);
+		auto forEachLoader = [&](const std::function<void(size_t)> & action) {
+			if (!concurrently) {
+				for (size_t i = 0; i < GROUPS; ++i) {
+					action(i);
+				}
+				return;
+			}
+			std::atomic<bool> go(false);
+			std::vector<std::thread> threads;
+			for (size_t i = 0; i < GROUPS; ++i) {
+				threads.emplace_back([&go, &action, i]() {
+					while (!go) {
+						std::this_thread::yield();
+					}
+					action(i);
+				});
+			}
+			go = true;
+			for (auto & thread : threads) {
+				thread.join();
+			}
+		};
+
+		forEachLoader([&](size_t i) {loaders[i].reset(new plugin::PluginLoader(libraries[i]));});
+		checkRegistrations(loaders);
+		forEachLoader([&](size_t i) {loaders[i].reset();});
+	};
+
+	try {
+		loadAll(false);
+		for (size_t round = 0; round < ROUNDS; ++round) {
+			loadAll(true);
+		}
+	}
+	catch (const plugin::PluginLoaderException & e) {
+		FAIL() << "Unexpected PluginLoaderException: " << e.what();
+	}
+
+	ASSERT_FALSE(plugin::impl::hasANonPurePluginLibraryBeenOpened());
+	for (auto & library : libraries) {
+		ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(library));
+	}
+}
+
+TEST(PluginLoaderTest, loadLibraryAsync) {
+	plugin::impl::ElfImage image(LIBRARY_2);
+	ASSERT_TRUE(image.isValid());
+	std::vector<std::string> needed = image.getNeededLibraries();
+	ASSERT_TRUE(std::any_of(needed.begin(), needed.end(), [](const std::string & library) {
+		return library.find("PluginLoader") != std::string::npos;
+	}));
+	ASSERT_GE(plugin::SharedLibrary::prefetch(LIBRARY_2), 1u);
+	ASSERT_EQ(0u, plugin::SharedLibrary::prefetch("./missing.so"));
+
+	{
+		plugin::PluginLoader loader(LIBRARY_2, true);
+		std::shared_future<void> load = loader.loadLibraryAsync();
+		// Waits for the pending load instead of loading again
+		std::shared_ptr<Base> robot = loader.createInstance<Base>("Robot");
+		ASSERT_EQ(std::future_status::ready, load.wait_for(std::chrono::seconds(0)));
+		load.get();
+		ASSERT_TRUE(loader.isLibraryLoaded());
+	}
+	ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+
+	plugin::PluginLoader missing("./missing.so", true);
+	ASSERT_THROW(missing.loadLibraryAsync().get(), plugin::LibraryLoadException);
+	ASSERT_FALSE(missing.isLibraryLoaded());
+}
+
+TEST(PluginLoaderTest, sharedLibraryOwnership) {
+	plugin::PluginLoader loader1(LIBRARY_1, false);
+	{
+		plugin::PluginLoader loader2(LIBRARY_1, false);
+		std::vector<std::string> libs = plugin::impl::getAllLibrariesUsedByPluginLoader(&loader2);
+		ASSERT_EQ(1u, libs.size());
+		ASSERT_EQ(LIBRARY_1, libs[0]);
+		ASSERT_TRUE(loader2.isClassAvailable<Base>("Cow"));
+	}
+	// loader2 released its ownership only; loader1 keeps the library and its factories
+	ASSERT_TRUE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+	ASSERT_EQ(5u, loader1.getAvailableClasses<Base>().size());
+	loader1.createInstance<Base>("Cow")->saySomething();
+
+	loader1.unloadLibrary();
+	ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+	ASSERT_TRUE(plugin::impl::getAllLibrariesUsedByPluginLoader(&loader1).empty());
+}
+
+TEST(PluginLoaderTest, factoryHandle) {
+	try {
+		plugin::PluginLoader loader1(LIBRARY_1, true);
+		plugin::FactoryHandle<Base> dog = loader1.getFactory<Base>("Dog");
+		ASSERT_FALSE(dog.isResolved());
+
+		{
+			std::shared_ptr<Base> obj = dog.create();
+			ASSERT_TRUE(loader1.isLibraryLoaded());
+			obj->saySomething();
+			ASSERT_TRUE(nullptr != dog.createUnique());
+		}
+		// On-demand unload invalidates the handle; the next create loads the library again
+		ASSERT_FALSE(loader1.isLibraryLoaded());
+		{
+			std::shared_ptr<Base> obj = dog.create();
+			ASSERT_TRUE(loader1.isLibraryLoaded());
+			ASSERT_TRUE(nullptr != dog.create());
+			ASSERT_TRUE(dog.isResolved());
+		}
+		ASSERT_FALSE(loader1.isLibraryLoaded());
+
+		plugin::FactoryHandle<Base> bear = loader1.getFactory<Base>("Bear");
+		bear.create();
+	}
+	catch (const plugin::CreateClassException &) {
+		SUCCEED();
+		return;
+	}
+	catch (...) {
+		FAIL() << "Unknown exception caught.\n";
+	}
+
+	FAIL() << "Did not throw exception as expected.\n";
+}
+
+TEST(PluginLoaderTest, instancePool) {
+	plugin::PluginLoader loader2(LIBRARY_2, true);
+	{
+		plugin::InstancePool<Base> robots(&loader2, "Robot", 4);
+		ASSERT_TRUE(loader2.isLibraryLoaded());
+		ASSERT_EQ(1u, robots.getIdleCount());
+		ASSERT_EQ(3u, robots.refill());
+		ASSERT_EQ(4u, robots.getIdleCount());
+
+		Base * recycled = nullptr;
+		{
+			plugin::InstancePool<Base>::Pointer robot = robots.acquire();
+			recycled = robot.get();
+			ASSERT_EQ(3u, robots.getIdleCount());
+		}
+		// Robot has a reset() hook, so the same object comes back
+		ASSERT_EQ(4u, robots.getIdleCount());
+		ASSERT_EQ(recycled, robots.acquire().get());
+
+		// Zombie has none: released zombies are destroyed
+		plugin::InstancePool<Base> zombies(&loader2, "Zombie", 4);
+		zombies.acquire()->saySomething();
+		ASSERT_EQ(0u, zombies.getIdleCount());
+
+		std::vector<std::thread> threads;
+		robots.startBackgroundRefill();
+		for (int i = 0; i < 4; ++i) {
+			threads.emplace_back([&robots]() {
+				for (int j = 0; j < 1000; ++j) {
+					ASSERT_TRUE(nullptr != robots.acquire());
+				}
+			});
+		}
+		for (auto & thread : threads) {
+			thread.join();
+		}
+		// Pooled objects keep the library loaded until the pool goes away
+		ASSERT_TRUE(loader2.isLibraryLoaded());
+	}
+	ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+
+	try {
+		plugin::InstancePool<Base> bears(&loader2, "Bear", 4);
+	}
+	catch (const plugin::CreateClassException &) {
+		SUCCEED();
+		return;
+	}
+	FAIL() << "Did not throw exception as expected.\n";
+}
+
+TEST(PluginLoaderTest, constructorArguments) {
+	plugin::PluginLoader loader2(LIBRARY_2, true);
+	{
+		std::shared_ptr<Base> ghost = loader2.createSharedInstance<Base>("Ghost", std::string("Casper"));
+		ghost->saySomething();
+		loader2.createUniqueInstance<Base>("Parrot", std::string("Hello"), 3)->saySomething();
+
+		// Lvalue arguments are copied
+		std::string word = "Polly";
+		loader2.createUniqueInstance<Base>("Parrot", word, 2)->saySomething();
+		ASSERT_EQ("Polly", word);
+	}
+
+	// Argument types must match the registration exactly
+	ASSERT_THROW(loader2.createSharedInstance<Base>("Ghost", "Casper"), plugin::CreateClassException);
+	ASSERT_THROW(loader2.createUniqueInstance<Base>("Parrot", std::string("Hello")), plugin::CreateClassException);
+	ASSERT_THROW(loader2.createUniqueInstance<Base>("Robot", 1), plugin::CreateClassException);
+	// Classes without a default constructor cannot be created without arguments
+	ASSERT_THROW(loader2.createInstance<Base>("Ghost"), plugin::CreateClassException);
+}
+
+class Unicorn : public Base
+{
+public:
+	virtual void saySomething() {std::cout << "Neigh" << std::endl;}
+};
+
+class Dragon : public Base
+{
+public:
+	virtual void saySomething() {std::cout << "Roar" << std::endl;}
+};
+
+constexpr auto STATIC_PLUGINS = plugin::makeStaticPluginTable<Base>(
+	PLUGIN_LOADER_STATIC_PLUGIN(Unicorn, Base),
+	PLUGIN_LOADER_STATIC_PLUGIN(Dragon, Base));
+static_assert(STATIC_PLUGINS.hasUniqueNames(), "Duplicate static plugin");
+static_assert(STATIC_PLUGINS.find("Dragon") == 1, "Static lookup is not resolved at compile time");
+
+TEST(PluginLoaderTest, staticPluginTable) {
+	// Resolved by the compiler, no registry involved
+	constexpr const plugin::StaticPlugin<Base> & unicorn = STATIC_PLUGINS.at("Unicorn");
+	std::unique_ptr<Base>(unicorn.create())->saySomething();
+	ASSERT_THROW(STATIC_PLUGINS.at("Bear"), plugin::CreateClassException);
+
+	const std::string library = "static:utest";
+	plugin::registerStaticPlugins(STATIC_PLUGINS, library);
+	ASSERT_THROW(plugin::registerStaticPlugins(STATIC_PLUGINS, library), plugin::LibraryLoadException);
+
+	// The same PluginLoader API, including on-demand load and unload
+	plugin::PluginLoader loader(library, true);
+	{
+		std::shared_ptr<Base> dragon = loader.createInstance<Base>("Dragon");
+		dragon->saySomething();
+		ASSERT_TRUE(loader.isLibraryLoaded());
+		ASSERT_EQ(2u, loader.getAvailableClasses<Base>().size());
+	}
+	ASSERT_FALSE(loader.isLibraryLoaded());
+	loader.createUniqueInstance<Base>("Unicorn")->saySomething();
+	ASSERT_FALSE(loader.isLibraryLoaded());
+	ASSERT_THROW(loader.createInstance<Base>("Cat"), plugin::CreateClassException);
+}
+
+TEST(PluginLoaderTest, libraryDescriptor) {
+	// Plugins3 registers its classes with one exported table instead of static initializers
+	plugin::PluginLoader loader3(LIBRARY_3, true);
+	for (int i = 0; i < 2; ++i) {
+		{
+			std::shared_ptr<Base> fish = loader3.createInstance<Base>("Fish");
+			fish->saySomething();
+			ASSERT_TRUE(loader3.isLibraryLoaded());
+			ASSERT_EQ(3u, loader3.getAvailableClasses<Base>().size());
+			ASSERT_TRUE(loader3.isClassAvailable<Base>("Frog"));
+		}
+		ASSERT_FALSE(loader3.isLibraryLoaded());
+	}
+
+	plugin::PluginLoader loader1(LIBRARY_1, false);
+	plugin::PluginLoader other_loader3(LIBRARY_3, false);
+	ASSERT_EQ(3u, other_loader3.getAvailableClasses<Base>().size());
+	ASSERT_FALSE(other_loader3.isClassAvailable<Base>("Dog"));
+	ASSERT_THROW(loader1.createInstance<Base>("Bird"), plugin::CreateClassException);
+}
+
 TEST(PluginLoaderTest, loadRefCountingNonLazy) {
 	try {
 		plugin::PluginLoader loader1(LIBRARY_1, false);
@@ -344,6 +822,400 @@ TEST(MultiPluginLoaderTest, noWarningOnLazyLoad) {
 	SUCCEED();
 }
 
+TEST(MultiPluginLoaderTest, classIndex) {
+	try {
+		plugin::MultiLibraryPluginLoader loader(true);
+		loader.loadLibrary(LIBRARY_1);
+		loader.loadLibrary(LIBRARY_2);
+
+		// Finding Cat must not open the second library
+		std::shared_ptr<Base> cat = loader.createInstance<Base>("Cat");
+		ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+		loader.createInstance<Base>("Robot")->saySomething();
+
+		ASSERT_EQ(0, loader.unloadLibrary(LIBRARY_2));
+		ASSERT_THROW(loader.createInstance<Base>("Robot"), plugin::CreateClassException);
+		loader.loadLibrary(LIBRARY_2);
+		loader.createInstance<Base>("Robot")->saySomething();
+		cat->saySomething();
+	}
+	catch (plugin::PluginLoaderException & e) {
+		FAIL() << "PluginLoaderException: " << e.what() << "\n";
+	}
+}
+
+TEST(MultiPluginLoaderTest, classQueries) {
+	plugin::MultiLibraryPluginLoader loader(false);
+	loader.loadLibrary(LIBRARY_1);
+	loader.loadLibrary(LIBRARY_2);
+
+	size_t visited = 0;
+	loader.forEachAvailableClass<Base>([&visited](std::string_view class_name) {
+		ASSERT_FALSE(class_name.empty());
+		++visited;
+	});
+	ASSERT_EQ(11u, visited);
+	ASSERT_EQ(visited, loader.getAvailableClasses<Base>().size());
+
+	ASSERT_TRUE(loader.isClassAvailable<Base>("Sheep"));
+	ASSERT_TRUE(loader.isClassAvailable<Base>(std::string_view("Zombie")));
+	ASSERT_FALSE(loader.isClassAvailable<Base>("Bear"));
+	ASSERT_FALSE(loader.isClassAvailable<InvalidBase>("Sheep"));
+
+	size_t libraries = 0;
+	loader.forEachRegisteredLibrary([&libraries](std::string_view) {++libraries;});
+	ASSERT_EQ(2u, libraries);
+}
+
+TEST(MultiPluginLoaderTest, manifests) {
+	{
+		// Classes are listed without opening anything; only the library a class comes from is loaded
+		plugin::MultiLibraryPluginLoader loader(true, true);
+		loader.loadLibrary(LIBRARY_1);
+		loader.loadLibrary(LIBRARY_2);
+		ASSERT_EQ(11u, loader.getAvailableClasses<Base>().size());
+		ASSERT_TRUE(loader.isClassAvailable<Base>("Parrot"));
+		ASSERT_FALSE(loader.isClassAvailable<InvalidBase>("Sheep"));
+		ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+		ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+
+		std::shared_ptr<Base> robot = loader.createInstance<Base>("Robot");
+		ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+		ASSERT_TRUE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+	}
+
+	// A manifest that does not match its library is dropped when the library is loaded
+	const std::string copy = LIBRARY_3 + ".copy";
+	{
+		std::ifstream source(LIBRARY_3, std::ios::binary);
+		std::ofstream destination(copy, std::ios::binary | std::ios::trunc);
+		destination << source.rdbuf();
+	}
+	plugin::PluginManifest stale;
+	ASSERT_TRUE(stale.read(plugin::PluginManifest::getManifestPath(LIBRARY_1)));
+	stale.write(plugin::PluginManifest::getManifestPath(copy));
+
+	{
+		plugin::PluginLoader loader(copy, true);
+		ASSERT_TRUE(loader.loadManifest());
+		ASSERT_TRUE(loader.isClassAvailable<Base>("Dog"));
+		std::shared_ptr<Base> fish = loader.createInstance<Base>("Fish");
+		ASSERT_FALSE(loader.hasManifest());
+		ASSERT_FALSE(loader.isClassAvailable<Base>("Dog"));
+		ASSERT_TRUE(loader.isClassAvailable<Base>("Fish"));
+	}
+	ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(copy));
+	std::remove(copy.c_str());
+	std::remove(plugin::PluginManifest::getManifestPath(copy).c_str());
+}
+
+TEST(MultiPluginLoaderTest, embeddedManifests) {
+	plugin::PluginManifest embedded;
+	ASSERT_TRUE(embedded.readEmbedded(LIBRARY_2));
+	ASSERT_TRUE(embedded.isEmbedded());
+	ASSERT_EQ(8u, embedded.getClasses().size());
+	ASSERT_TRUE(embedded.hasClass(typeid(Base).name(), "Ghost"));
+	ASSERT_TRUE(embedded.hasClass(typeid(Base).name(), "Parrot"));
+	// Bases named through a using declaration and a typedef
+	ASSERT_TRUE(embedded.hasClass(typeid(zoo::Keeper).name(), "NightKeeper"));
+	ASSERT_TRUE(embedded.hasClass(typeid(zoo::Keeper).name(), "DayKeeper"));
+	{
+		plugin::PluginLoader loader(LIBRARY_2, false);
+		ASSERT_TRUE(embedded.verify(LIBRARY_2));
+		loader.createInstance<zoo::Keeper>("DayKeeper")->feed();
+	}
+	ASSERT_FALSE(embedded.readEmbedded(LIBRARY_3));
+	ASSERT_FALSE(embedded.readEmbedded(plugin::PluginManifest::getManifestPath(LIBRARY_1)));
+	ASSERT_TRUE(embedded.getClasses().empty());
+
+	// Without a manifest file next to the library, the loader lists the embedded classes and checks them on load
+	const std::string copy = LIBRARY_1 + ".embedded";
+	{
+		std::ifstream source(LIBRARY_1, std::ios::binary);
+		std::ofstream destination(copy, std::ios::binary | std::ios::trunc);
+		destination << source.rdbuf();
+	}
+	std::remove(plugin::PluginManifest::getManifestPath(copy).c_str());
+
+	{
+		plugin::PluginLoader loader(copy, true);
+		ASSERT_TRUE(loader.loadManifest());
+		ASSERT_EQ(5u, loader.getAvailableClasses<Base>().size());
+		ASSERT_TRUE(loader.isClassAvailable<Base>("Sheep"));
+		ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(copy));
+		std::shared_ptr<Base> cow = loader.createInstance<Base>("Cow");
+		ASSERT_TRUE(plugin::impl::isLibraryLoadedByAnybody(copy));
+		ASSERT_TRUE(loader.hasManifest());
+	}
+	ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(copy));
+	std::remove(copy.c_str());
+}
+
+TEST(MultiPluginLoaderTest, loadLibraries) {
+	{
+		// A missing library is reported without stopping the others
+		plugin::MultiLibraryPluginLoader loader(false);
+		plugin::LibraryLoadErrors errors = loader.loadLibraries({LIBRARY_1, "./missing.so", LIBRARY_2, LIBRARY_1}, {}, 3);
+		ASSERT_EQ(1u, errors.size());
+		ASSERT_EQ(1u, errors.count("./missing.so"));
+		ASSERT_FALSE(errors["./missing.so"].empty());
+		ASSERT_EQ(2u, loader.getRegisteredLibraries().size());
+		ASSERT_TRUE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+		ASSERT_TRUE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+		ASSERT_EQ(11u, loader.getAvailableClasses<Base>().size());
+		loader.createInstance<Base>("Dog")->saySomething();
+		loader.createInstance<Base>("Robot")->saySomething();
+	}
+	ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+	ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+
+	plugin::MultiLibraryPluginLoader loader(false);
+	ASSERT_TRUE(loader.loadDirectory(".", "libPluginLoader_TestPlugins?" + plugin::SharedLibrary::suffix()).empty());
+	ASSERT_EQ(3u, loader.getRegisteredLibraries().size());
+	ASSERT_TRUE(loader.isClassAvailable<Base>("Fish"));
+	ASSERT_THROW(loader.loadDirectory("./missing", "*"), plugin::LibraryLoadException);
+}
+
+TEST(MultiPluginLoaderTest, loadPlan) {
+	{
+		plugin::MultiLibraryPluginLoader loader(false, true);
+		plugin::LibraryLoadErrors errors = loader.loadPlan({
+			{LIBRARY_3, 0}, {"./missing.so", 0}, {LIBRARY_2, 10}, {LIBRARY_1, 5}, {LIBRARY_2, 0}}, 10, {}, 1);
+		ASSERT_TRUE(errors.empty());
+		ASSERT_EQ(4u, loader.getRegisteredLibraries().size());
+		ASSERT_TRUE(loader.isLibraryAvailable(LIBRARY_2));
+		ASSERT_TRUE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+
+		// Only waits for the library of the class, whether or not the worker got to it
+		loader.createInstance<Base>("Dog")->saySomething();
+		ASSERT_TRUE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+		loader.createInstance<Base>("Robot")->saySomething();
+
+		loader.waitForBackgroundLoads();
+		ASSERT_TRUE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_3));
+		ASSERT_THROW(loader.createInstance<Base>("Dog", "./missing.so"), plugin::LibraryLoadException);
+	}
+	ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+	ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+	ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_3));
+
+	// Queued loads nobody started are dropped with the loader
+	plugin::MultiLibraryPluginLoader loader(false);
+	loader.loadPlan({{LIBRARY_1, 0}, {LIBRARY_3, 0}}, 1, {}, 1);
+}
+
+TEST(MultiPluginLoaderTest, queriesDuringLoads) {
+	plugin::MultiLibraryPluginLoader loader(false);
+	std::atomic<bool> loading(true);
+	std::thread querier([&loader, &loading]() {
+			while (loading.load()) {
+				loader.isClassAvailable<Base>("Gear8");
+				loader.getAvailableClasses<Base>();
+				loader.getRegisteredLibraries();
+			}
+		});
+	std::vector<std::thread> loaders;
+	for (int group = 1; group <= 8; ++group) {
+		loaders.emplace_back([&loader, group]() {
+				loader.loadLibrary(GROUP_LIBRARY_PREFIX + std::to_string(group) + GROUP_LIBRARY_SUFFIX);
+			});
+	}
+	for (auto & thread : loaders) {
+		thread.join();
+	}
+	loading.store(false);
+	querier.join();
+	ASSERT_EQ(8u, loader.getRegisteredLibraries().size());
+	ASSERT_EQ(24u, loader.getAvailableClasses<Base>().size());
+}
+
+TEST(MultiPluginLoaderTest, libraryOpenedByAnotherLoader) {
+	plugin::PluginLoader other_loader(LIBRARY_1);
+	ASSERT_TRUE(other_loader.isLibraryLoaded());
+	{
+		// Loads on demand: its loader has not loaded the library itself when the class is first asked for
+		plugin::MultiLibraryPluginLoader loader(true);
+		loader.loadLibrary(LIBRARY_1);
+		loader.createInstance<Base>("Cat")->saySomething();
+		loader.createInstance<Base>("Dog")->saySomething();
+	}
+	ASSERT_TRUE(other_loader.isLibraryLoaded());
+}
+
+TEST(MultiPluginLoaderTest, usageProfile) {
+	plugin::UsageProfile::setRecording(true);
+	{
+		plugin::MultiLibraryPluginLoader loader(false);
+		loader.loadLibraries({LIBRARY_1, LIBRARY_2});
+		loader.createInstance<Base>("Dog")->saySomething();
+		loader.createUniqueInstance<Base>("Dog")->saySomething();
+		plugin::PluginLoader batch_loader(LIBRARY_1);
+		ASSERT_EQ(3u, batch_loader.createInstances<Base>("Cat", 3).size());
+	}
+	plugin::UsageProfile::setRecording(false);
+	plugin::UsageProfile profile = plugin::UsageProfile::capture();
+
+	const plugin::UsageProfile::LibraryUsage * usage = profile.findLibrary(LIBRARY_1);
+	ASSERT_NE(nullptr, usage);
+	ASSERT_GE(usage->loads, 1u);
+	ASSERT_GE(usage->getCreations(), 5u);
+	ASSERT_TRUE(profile.isHot(LIBRARY_1));
+	ASSERT_FALSE(profile.isHot(LIBRARY_2));
+	ASSERT_FALSE(profile.isHot(LIBRARY_3));
+
+	const std::string profile_path = "./usage.profile";
+	profile.write(profile_path);
+	plugin::UsageProfile read_profile;
+	ASSERT_TRUE(read_profile.read(profile_path));
+	ASSERT_EQ(profile.getLibraries().size(), read_profile.getLibraries().size());
+	ASSERT_EQ(usage->getCreations(), read_profile.findLibrary(LIBRARY_1)->getCreations());
+	std::remove(profile_path.c_str());
+
+	{
+		// The hot library is loaded in the background, the cold ones on first use
+		plugin::MultiLibraryPluginLoader loader(false);
+		loader.loadWithProfile({LIBRARY_1, LIBRARY_2, LIBRARY_3}, read_profile, {}, 1);
+		ASSERT_EQ(3u, loader.getRegisteredLibraries().size());
+		loader.waitForBackgroundLoads();
+		ASSERT_TRUE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+		ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+		ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_3));
+		loader.createInstance<Base>("Robot", LIBRARY_2)->saySomething();
+		ASSERT_TRUE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+		ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_3));
+	}
+	ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_1));
+	ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(LIBRARY_2));
+}
+
+TEST(MultiPluginLoaderTest, pluginIndex) {
+	const std::filesystem::path directory = "./plugin_index";
+	std::filesystem::remove_all(directory);
+	std::filesystem::create_directory(directory);
+	const std::string library_1 = (directory / std::filesystem::path(LIBRARY_1).filename()).string();
+	const std::string library_2 = (directory / std::filesystem::path(LIBRARY_2).filename()).string();
+	const std::string library_3 = (directory / std::filesystem::path(LIBRARY_3).filename()).string();
+	std::filesystem::copy_file(LIBRARY_1, library_1);
+	std::filesystem::copy_file(LIBRARY_2, library_2);
+
+	plugin::PluginIndex index(directory.string());
+	ASSERT_EQ(2u, index.update());
+	ASSERT_EQ(0u, index.update());
+	ASSERT_EQ(library_1, index.findLibraryForClass<Base>("Dog"));
+	ASSERT_EQ(library_2, index.findLibraryForClass<Base>("Robot"));
+	ASSERT_TRUE(index.findLibraryForClass<Base>("Bear").empty());
+
+	// Read back, nothing changed on disk
+	const std::string index_path = (directory / "plugins.index").string();
+	index.write(index_path);
+	plugin::PluginIndex read_index(directory.string());
+	ASSERT_TRUE(read_index.read(index_path));
+	ASSERT_EQ(0u, read_index.update());
+	ASSERT_EQ(library_2, read_index.findLibraryForClass<Base>("Robot"));
+
+	{
+		// Only the library of the class is opened
+		plugin::MultiLibraryPluginLoader loader(false);
+		loader.setPluginIndex(&read_index);
+		loader.createInstance<Base>("Robot")->saySomething();
+		ASSERT_EQ(1u, loader.getRegisteredLibraries().size());
+		ASSERT_TRUE(loader.isLibraryAvailable(library_2));
+		ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(library_1));
+		ASSERT_THROW(loader.createInstance<Base>("Bear"), plugin::CreateClassException);
+	}
+
+#if defined(__linux__)
+	ASSERT_TRUE(index.startWatching());
+	ASSERT_EQ(0u, index.processEvents());
+	std::filesystem::copy_file(LIBRARY_3, library_3);
+	std::filesystem::remove(library_1);
+	ASSERT_EQ(2u, index.processEvents());
+	ASSERT_TRUE(index.findLibraryForClass<Base>("Dog").empty());
+	ASSERT_EQ(2u, index.getEntries().size());
+	ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(library_3));
+#endif
+	std::filesystem::remove_all(directory);
+}
+
+class WarningRecorder : public plugin::OutputHandler
+{
+public:
+	void log(const std::string & text, plugin::LogLevel level, const char *, int) override
+	{
+		if (level >= plugin::CONSOLE_LOG_WARN) {
+			warnings.push_back(text);
+		}
+	}
+
+	std::vector<std::string> warnings;
+};
+
+TEST(MultiPluginLoaderTest, reloadLibrary) {
+	// Group 9 is not opened globally by the other tests, its classes would then bind to that copy
+	const std::string library = GROUP_LIBRARY_PREFIX + "9" + GROUP_LIBRARY_SUFFIX;
+	const std::string generation_1 = library + ".generation1";
+	const std::string generation_2 = library + ".generation2";
+
+	plugin::SharedLibrary::LoadOptions local_options;
+	local_options.scope = plugin::SharedLibrary::SCOPE_LOCAL;
+	WarningRecorder recorder;
+	const plugin::LogLevel log_level = plugin::getLogLevel();
+	plugin::setLogLevel(plugin::CONSOLE_LOG_WARN);
+	plugin::useOutputHandler(&recorder);
+	{
+		plugin::MultiLibraryPluginLoader loader(false);
+		loader.loadLibrary(library, local_options);
+		std::shared_ptr<Base> old_gear = loader.createInstance<Base>("Gear9");
+		const plugin::impl::MetaObjectVector old_factories = plugin::impl::allMetaObjectsForLibrary(library);
+		ASSERT_FALSE(old_factories.empty());
+
+		ASSERT_EQ(1u, loader.reloadLibrary(library));
+		ASSERT_TRUE(loader.isLibraryAvailable(library));
+		ASSERT_TRUE(std::filesystem::exists(generation_1));
+		// The old generation stays loaded for its instance, with its factories retired
+		ASSERT_TRUE(plugin::impl::isLibraryLoadedByAnybody(library));
+		ASSERT_EQ(old_factories.size(), plugin::impl::allMetaObjectsForLibrary(library).size());
+		for (auto & factory : plugin::impl::allMetaObjects()) {
+			ASSERT_EQ(old_factories.end(), std::find(old_factories.begin(), old_factories.end(), factory));
+		}
+
+		std::shared_ptr<Base> new_gear = loader.createInstance<Base>("Gear9");
+		ASSERT_NE(*reinterpret_cast<void **>(old_gear.get()), *reinterpret_cast<void **>(new_gear.get()));
+		old_gear->saySomething();
+		old_gear.reset();
+		ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(library));
+		// Destroyed with their generation rather than parked in the graveyard
+		ASSERT_TRUE(plugin::impl::allMetaObjectsForLibrary(library).empty());
+		{
+			std::unique_lock<std::recursive_mutex> lock(plugin::impl::getPluginBaseToFactoryMapMapMutex());
+			for (auto & factory : plugin::impl::getMetaObjectGraveyard()) {
+				ASSERT_NE(library, factory->getAssociatedLibraryPath());
+			}
+		}
+		new_gear->saySomething();
+
+		ASSERT_EQ(2u, loader.reloadLibrary(library));
+		ASSERT_TRUE(std::filesystem::exists(generation_2));
+		loader.createInstance<Base>("Spring9")->saySomething();
+		new_gear.reset();
+		ASSERT_THROW(loader.reloadLibrary("./missing.so"), plugin::NoPluginLoaderExistsException);
+		// Retired generations are collected by the next call
+		ASSERT_FALSE(std::filesystem::exists(generation_1));
+
+		ASSERT_TRUE(plugin::impl::allMetaObjectsForLibrary(generation_1).empty());
+
+		loader.loadLibrary(LIBRARY_2);
+		ASSERT_THROW(loader.reloadLibrary(LIBRARY_2), plugin::LibraryLoadException);
+	}
+	plugin::restorePreviousOutputHandler();
+	plugin::setLogLevel(log_level);
+	ASSERT_FALSE(std::filesystem::exists(generation_2));
+	ASSERT_FALSE(plugin::impl::isLibraryLoadedByAnybody(generation_2));
+	for (auto & warning : recorder.warnings) {
+		ASSERT_EQ(std::string::npos, warning.find("collision")) << warning;
+	}
+}
+
 class Caaat : public Base
 {
 public:
@@ -44,7 +44,11 @@
 
 #include "base.hpp"
 
+#ifdef _WIN32
 const std::string LIBRARY_1 = "PluginLoader_TestPluginsMathFunctions.dll";  // NOLINT
+#else
+const std::string LIBRARY_1 = "./libPluginLoader_TestPluginsMathFunctions.so";  // NOLINT
+#endif
 
 const double PARAM1 = 1.0;
 const double PARAM2 = 2.0;
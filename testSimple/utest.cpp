@@ -34,7 +34,11 @@
 #include <plugins/Console.h>
 #include <iostream>
 
+#ifdef _WIN32
 const std::string LIBRARY_1 = "PluginLoader_TestPlugins1.dll";  // NOLINT
+#else
+const std::string LIBRARY_1 = "./libPluginLoader_TestPlugins1.so";  // NOLINT
+#endif
 
 // Run all the tests that were declared with TEST()
 int main()
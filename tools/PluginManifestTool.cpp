@@ -0,0 +1,51 @@
+/*
+ * Build step writing the manifest of plugin libraries next to them (@see plugin::PluginManifest).
+ * Usage: PluginLoader_manifest <library> [<library> ...]
+ *        PluginLoader_manifest --embedded <library> [<library> ...]
+ * The second form only lists the classes embedded in the libraries (@see PluginManifest::readEmbedded()), without
+ * loading them or writing anything.
+ */
+
+#include <cstdio>
+#include <exception>
+#include <string>
+
+#include <plugins/PluginManifest.hpp>
+
+int main(int argc, char ** argv)
+{
+	const bool embedded = argc > 1 && std::string(argv[1]) == "--embedded";
+	const int first = embedded ? 2 : 1;
+	if (argc <= first) {
+		std::fprintf(stderr, "Usage: %s [--embedded] <library> [<library> ...]\n", argv[0]);
+		return 2;
+	}
+
+	int result = 0;
+	for (int i = first; i < argc; ++i) {
+		const std::string library_path = argv[i];
+		if (embedded) {
+			plugin::PluginManifest manifest;
+			if (!manifest.readEmbedded(library_path)) {
+				std::fprintf(stderr, "%s: no embedded classes\n", library_path.c_str());
+				result = 1;
+				continue;
+			}
+			for (const plugin::PluginManifest::Entry & entry : manifest.getClasses()) {
+				std::printf("%s\t%s\t%s\n", library_path.c_str(), entry.base_class_name.c_str(),
+					entry.class_name.c_str());
+			}
+			continue;
+		}
+		try {
+			plugin::PluginManifest manifest = plugin::PluginManifest::generate(library_path);
+			manifest.write(plugin::PluginManifest::getManifestPath(library_path));
+			std::printf("%s: %zu classes\n", library_path.c_str(), manifest.getClasses().size());
+		}
+		catch (const std::exception & e) {
+			std::fprintf(stderr, "%s: %s\n", library_path.c_str(), e.what());
+			result = 1;
+		}
+	}
+	return result;
+}